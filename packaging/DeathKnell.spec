@@ -5,7 +5,7 @@ Summary:       An implementation of an "on-death" callback structure built from
 Group:         Development/Tools
 License:       MIT
 URL:           https://github.com/logrhythm/deathknell
-BuildRequires: cmake >= 2.8, gperftools >= 2.0, g3logrotate, FileIO
+BuildRequires: cmake >= 2.8, gperftools >= 2.0, g3logrotate, FileIO, systemtap-sdt-devel
 Requires:      g3log, dpiUser
 ExclusiveArch: x86_64
 
@@ -56,6 +56,8 @@ mkdir -p $RPM_BUILD_ROOT/usr/local/probe/lib
 cp -rfd lib%{name}.so* $RPM_BUILD_ROOT/usr/local/probe/lib
 mkdir -p $RPM_BUILD_ROOT/usr/local/probe/include
 cp src/*.h $RPM_BUILD_ROOT/usr/local/probe/include
+mkdir -p $RPM_BUILD_ROOT/usr/local/probe/bin
+cp deathknell-inspect $RPM_BUILD_ROOT/usr/local/probe/bin
 
 
 %post
@@ -68,3 +70,4 @@ cp src/*.h $RPM_BUILD_ROOT/usr/local/probe/include
 %defattr(-,dpi,dpi,-)
 /usr/local/probe/lib
 /usr/local/probe/include
+/usr/local/probe/bin
@@ -0,0 +1,55 @@
+
+#include "Breadcrumbs.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+Breadcrumbs::Breadcrumbs() : mNext(0) {
+   for (auto& entry : mEntries) {
+      entry.sequence.store(0);
+      entry.realtimeNs = 0;
+      entry.text[0] = '\0';
+   }
+}
+
+void Breadcrumbs::Leave(const char* text, size_t length) {
+   const uint64_t ticket = mNext.fetch_add(1, std::memory_order_relaxed);
+   Entry& entry = mEntries[ticket % kCapacity];
+   entry.sequence.store(ticket * 2 + 1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+
+   struct timespec now;
+   clock_gettime(CLOCK_REALTIME, &now);
+   entry.realtimeNs = static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+   length = std::min(length, kTextSize - 1);
+   memcpy(entry.text, text, length);
+   entry.text[length] = '\0';
+
+   entry.sequence.store(ticket * 2 + 2, std::memory_order_release);
+}
+
+/// @return the readable breadcrumbs, oldest first
+std::vector<Breadcrumbs::Crumb> Breadcrumbs::Collect() const {
+   std::vector<Crumb> crumbs;
+   const uint64_t next = mNext.load(std::memory_order_acquire);
+   const uint64_t first = next > kCapacity ? next - kCapacity : 0;
+   for (uint64_t ticket = first; ticket < next; ++ticket) {
+      const Entry& entry = mEntries[ticket % kCapacity];
+      if (entry.sequence.load(std::memory_order_acquire) != ticket * 2 + 2) {
+         continue;
+      }
+      Crumb crumb{entry.realtimeNs, std::string(entry.text, strnlen(entry.text, kTextSize))};
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (entry.sequence.load(std::memory_order_relaxed) == ticket * 2 + 2) {
+         crumbs.push_back(std::move(crumb));
+      }
+   }
+   return crumbs;
+}
+
+void Breadcrumbs::Clear() {
+   for (auto& entry : mEntries) {
+      entry.sequence.store(0, std::memory_order_relaxed);
+   }
+   mNext.store(0, std::memory_order_release);
+}
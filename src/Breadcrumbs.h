@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Fixed size ring of the most recent breadcrumbs. Leaving a breadcrumb never
+ * allocates or locks, the ring is copied out into the crash record at death.
+ * Entries that are overwritten while being read are dropped.
+ */
+class Breadcrumbs {
+public:
+   static const size_t kCapacity = 32;
+   static const size_t kTextSize = 112;
+
+   struct Crumb {
+      uint64_t realtimeNs;
+      std::string text;
+   };
+
+   Breadcrumbs();
+   void Leave(const char* text, size_t length);
+   std::vector<Crumb> Collect() const;
+   void Clear();
+
+private:
+   struct Entry {
+      std::atomic<uint64_t> sequence; // odd while being written
+      uint64_t realtimeNs;
+      char text[kTextSize];
+   };
+
+   std::atomic<uint64_t> mNext;
+   Entry mEntries[kCapacity];
+};
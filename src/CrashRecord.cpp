@@ -0,0 +1,590 @@
+
+#include "CrashRecord.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <ctime>
+#include <cstdlib>
+#include <cxxabi.h>
+
+namespace {
+   const uint32_t kMaxSectionLength = 64 * 1024 * 1024;
+
+   void JsonString(std::ostream& output, const std::string& value) {
+      output << '"';
+      for (unsigned char c : value) {
+         switch (c) {
+            case '"': output << "\\\""; break;
+            case '\\': output << "\\\\"; break;
+            case '\n': output << "\\n"; break;
+            case '\r': output << "\\r"; break;
+            case '\t': output << "\\t"; break;
+            default:
+               if (c < 0x20) {
+                  char escaped[8];
+                  snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                  output << escaped;
+               } else {
+                  output << c;
+               }
+         }
+      }
+      output << '"';
+   }
+
+   void JsonHex(std::ostream& output, uint64_t value) {
+      char hex[24];
+      snprintf(hex, sizeof(hex), "\"0x%llx\"", static_cast<unsigned long long>(value));
+      output << hex;
+   }
+
+   bool FatalToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t signal = 0;
+      uint32_t line = 0;
+      std::string level, file, function, thread, message;
+      if (!cursor.GetU32(signal) || !cursor.GetString(level) || !cursor.GetString(file) ||
+              !cursor.GetU32(line) || !cursor.GetString(function) || !cursor.GetString(thread) ||
+              !cursor.GetString(message)) {
+         return false;
+      }
+      output << ",\"signal\":" << signal << ",\"level\":";
+      JsonString(output, level);
+      output << ",\"file\":";
+      JsonString(output, file);
+      output << ",\"line\":" << line << ",\"function\":";
+      JsonString(output, function);
+      output << ",\"thread\":";
+      JsonString(output, thread);
+      output << ",\"message\":";
+      JsonString(output, message);
+      return true;
+   }
+
+   bool TimingsToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t count = 0;
+      if (!cursor.GetU32(count)) {
+         return false;
+      }
+      output << ",\"stages\":[";
+      for (uint32_t i = 0; i < count; ++i) {
+         uint16_t stage = 0;
+         uint16_t index = 0;
+         uint32_t reserved = 0;
+         uint64_t nanoseconds = 0;
+         if (!cursor.GetU16(stage) || !cursor.GetU16(index) || !cursor.GetU32(reserved) || !cursor.GetU64(nanoseconds)) {
+            return false;
+         }
+         output << (i ? "," : "") << "{\"stage\":";
+         JsonString(output, CrashRecord::StageName(stage));
+         output << ",\"index\":" << index << ",\"ns\":" << nanoseconds << "}";
+      }
+      output << "]";
+      return true;
+   }
+
+   bool CallbacksToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t count = 0;
+      if (!cursor.GetU32(count)) {
+         return false;
+      }
+      output << ",\"callbacks\":[";
+      for (uint32_t i = 0; i < count; ++i) {
+         uint64_t address = 0;
+         uint8_t status = 0;
+         std::string argument;
+         if (!cursor.GetU64(address) || !cursor.GetU8(status) || !cursor.GetString(argument)) {
+            return false;
+         }
+         static const char* kStatus[] = {"not_run", "completed", "fatal", "skipped_after_fork"};
+         output << (i ? "," : "") << "{\"address\":";
+         JsonHex(output, address);
+         output << ",\"status\":\"" << (status < 4 ? kStatus[status] : "unknown") << "\",\"argument\":";
+         JsonString(output, argument);
+         output << "}";
+      }
+      output << "]";
+      return true;
+   }
+
+   bool BreadcrumbsToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t count = 0;
+      if (!cursor.GetU32(count)) {
+         return false;
+      }
+      output << ",\"breadcrumbs\":[";
+      for (uint32_t i = 0; i < count; ++i) {
+         uint64_t realtimeNs = 0;
+         std::string text;
+         if (!cursor.GetU64(realtimeNs) || !cursor.GetString(text)) {
+            return false;
+         }
+         output << (i ? "," : "") << "{\"realtime_ns\":" << realtimeNs << ",\"text\":";
+         JsonString(output, text);
+         output << "}";
+      }
+      output << "]";
+      return true;
+   }
+
+   bool ThreadContextToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t count = 0;
+      if (!cursor.GetU32(count)) {
+         return false;
+      }
+      output << ",\"threads\":[";
+      for (uint32_t i = 0; i < count; ++i) {
+         uint32_t tid = 0;
+         uint8_t faulting = 0;
+         uint8_t tagCount = 0;
+         if (!cursor.GetU32(tid) || !cursor.GetU8(faulting) || !cursor.GetU8(tagCount)) {
+            return false;
+         }
+         output << (i ? "," : "") << "{\"tid\":" << tid << ",\"faulting\":" << (faulting ? "true" : "false")
+                << ",\"tags\":[";
+         for (uint8_t tag = 0; tag < tagCount; ++tag) {
+            uint64_t value = 0;
+            if (!cursor.GetU64(value)) {
+               return false;
+            }
+            output << (tag ? "," : "") << value;
+         }
+         std::string label;
+         if (!cursor.GetString(label)) {
+            return false;
+         }
+         output << "],\"label\":";
+         JsonString(output, label);
+         output << "}";
+      }
+      output << "]";
+      return true;
+   }
+
+   bool ThreadsToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t count = 0;
+      if (!cursor.GetU32(count)) {
+         return false;
+      }
+      output << ",\"threads\":[";
+      for (uint32_t i = 0; i < count; ++i) {
+         uint32_t tid = 0;
+         std::string name, role;
+         uint64_t cpuNs = 0;
+         if (!cursor.GetU32(tid) || !cursor.GetString(name) || !cursor.GetString(role) || !cursor.GetU64(cpuNs)) {
+            return false;
+         }
+         output << (i ? "," : "") << "{\"tid\":" << tid << ",\"name\":";
+         JsonString(output, name);
+         output << ",\"role\":";
+         JsonString(output, role);
+         output << ",\"cpu_ns\":" << cpuNs << "}";
+      }
+      output << "]";
+      return true;
+   }
+
+   bool RawStackToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t count = 0;
+      if (!cursor.GetU32(count)) {
+         return false;
+      }
+      output << ",\"frames\":[";
+      for (uint32_t i = 0; i < count; ++i) {
+         uint64_t frame = 0;
+         if (!cursor.GetU64(frame)) {
+            return false;
+         }
+         output << (i ? "," : "");
+         JsonHex(output, frame);
+      }
+      output << "]";
+      return true;
+   }
+
+   bool MemoryReserveToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint64_t released = 0;
+      uint64_t used = 0;
+      if (!cursor.GetU64(released) || !cursor.GetU64(used)) {
+         return false;
+      }
+      output << ",\"released\":" << released << ",\"used\":" << used;
+      return true;
+   }
+
+   bool FreezeToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint8_t mode = 0;
+      uint32_t expected = 0;
+      uint32_t acknowledged = 0;
+      uint64_t waitNs = 0;
+      if (!cursor.GetU8(mode) || !cursor.GetU32(expected) || !cursor.GetU32(acknowledged) || !cursor.GetU64(waitNs)) {
+         return false;
+      }
+      static const char* kModes[] = {"none", "safepoint", "signal"};
+      output << ",\"mode\":\"" << (mode < 3 ? kModes[mode] : "unknown") << "\",\"expected\":" << expected
+             << ",\"acknowledged\":" << acknowledged << ",\"wait_ns\":" << waitNs;
+      return true;
+   }
+
+   bool DurableRegionsToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t count = 0;
+      if (!cursor.GetU32(count)) {
+         return false;
+      }
+      static const char* kKinds[] = {"mapping", "file"};
+      static const char* kStatus[] = {"pending", "flushing", "done", "failed"};
+      output << ",\"regions\":[";
+      for (uint32_t i = 0; i < count; ++i) {
+         uint8_t kind = 0;
+         uint8_t status = 0;
+         uint32_t error = 0;
+         uint64_t nanoseconds = 0;
+         std::string name;
+         if (!cursor.GetU8(kind) || !cursor.GetU8(status) || !cursor.GetU32(error) || !cursor.GetU64(nanoseconds) ||
+                 !cursor.GetString(name)) {
+            return false;
+         }
+         output << (i ? "," : "") << "{\"name\":";
+         JsonString(output, name);
+         output << ",\"kind\":\"" << (kind < 2 ? kKinds[kind] : "unknown") << "\",\"status\":\""
+                << (status < 4 ? kStatus[status] : "unknown") << "\",\"errno\":" << static_cast<int32_t>(error)
+                << ",\"ns\":" << nanoseconds << "}";
+      }
+      output << "]";
+      return true;
+   }
+
+   bool SocketsToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t count = 0;
+      if (!cursor.GetU32(count)) {
+         return false;
+      }
+      output << ",\"sockets\":[";
+      for (uint32_t i = 0; i < count; ++i) {
+         uint16_t port = 0;
+         uint32_t error = 0;
+         if (!cursor.GetU16(port) || !cursor.GetU32(error)) {
+            return false;
+         }
+         output << (i ? "," : "") << "{\"port\":" << port << ",\"errno\":" << static_cast<int32_t>(error) << "}";
+      }
+      output << "]";
+      return true;
+   }
+
+   bool SpillToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint32_t queues = 0;
+      uint64_t events = 0;
+      uint64_t bytes = 0;
+      uint32_t error = 0;
+      if (!cursor.GetU32(queues) || !cursor.GetU64(events) || !cursor.GetU64(bytes) || !cursor.GetU32(error)) {
+         return false;
+      }
+      output << ",\"queues\":" << queues << ",\"events\":" << events << ",\"bytes\":" << bytes
+             << ",\"errno\":" << static_cast<int32_t>(error);
+      return true;
+   }
+
+   bool ArenaToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      uint64_t capacity = 0;
+      uint64_t used = 0;
+      if (!cursor.GetU64(capacity) || !cursor.GetU64(used)) {
+         return false;
+      }
+      output << ",\"capacity\":" << capacity << ",\"used\":" << used;
+      return true;
+   }
+
+   /// The writer stores the mangled name, demangling is left to the reader
+   bool ExceptionToJson(CrashRecord::PayloadCursor& cursor, std::ostream& output) {
+      std::string mangled, what;
+      if (!cursor.GetString(mangled) || !cursor.GetString(what)) {
+         return false;
+      }
+      int status = -1;
+      char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+      output << ",\"exception_type\":";
+      JsonString(output, (status == 0 && demangled != nullptr) ? std::string(demangled) : mangled);
+      free(demangled);
+      output << ",\"mangled\":";
+      JsonString(output, mangled);
+      output << ",\"what\":";
+      JsonString(output, what);
+      return true;
+   }
+
+   bool SectionToJson(uint16_t type, const std::string& payload, std::ostream& output) {
+      CrashRecord::PayloadCursor cursor(payload);
+      switch (type) {
+         case CrashRecord::Fatal: return FatalToJson(cursor, output);
+         case CrashRecord::Timings: return TimingsToJson(cursor, output);
+         case CrashRecord::Callbacks: return CallbacksToJson(cursor, output);
+         case CrashRecord::Breadcrumbs: return BreadcrumbsToJson(cursor, output);
+         case CrashRecord::RawStack: return RawStackToJson(cursor, output);
+         case CrashRecord::MemoryReserve: return MemoryReserveToJson(cursor, output);
+         case CrashRecord::Arena: return ArenaToJson(cursor, output);
+         case CrashRecord::Exception: return ExceptionToJson(cursor, output);
+         case CrashRecord::ThreadContext: return ThreadContextToJson(cursor, output);
+         case CrashRecord::Threads: return ThreadsToJson(cursor, output);
+         case CrashRecord::Freeze: return FreezeToJson(cursor, output);
+         case CrashRecord::DurableRegions: return DurableRegionsToJson(cursor, output);
+         case CrashRecord::Sockets: return SocketsToJson(cursor, output);
+         case CrashRecord::Spill: return SpillToJson(cursor, output);
+         default:
+            output << ",\"id\":" << type << ",\"length\":" << payload.size();
+            return true;
+      }
+   }
+} // anonymous
+
+namespace CrashRecord {
+
+   Writer::Writer() : mSectionStart(std::string::npos) {
+      FileHeader header;
+      memset(&header, 0, sizeof(header));
+      header.magic = kMagic;
+      header.version = kVersion;
+      header.headerSize = sizeof(FileHeader);
+      header.pid = static_cast<uint32_t>(getpid());
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      header.realtimeNs = static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+      mBuffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+   }
+
+   void Writer::Begin(SectionType type) {
+      if (mSectionStart != std::string::npos) {
+         End();
+      }
+      SectionHeader section{static_cast<uint16_t>(type), 0, 0};
+      mSectionStart = mBuffer.size();
+      mBuffer.append(reinterpret_cast<const char*>(&section), sizeof(section));
+   }
+
+   void Writer::End() {
+      if (mSectionStart == std::string::npos) {
+         return;
+      }
+      uint32_t length = static_cast<uint32_t>(mBuffer.size() - mSectionStart - sizeof(SectionHeader));
+      memcpy(&mBuffer[mSectionStart + offsetof(SectionHeader, length)], &length, sizeof(length));
+      mSectionStart = std::string::npos;
+   }
+
+   void Writer::PutU8(uint8_t value) {
+      mBuffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+   }
+
+   void Writer::PutU16(uint16_t value) {
+      mBuffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+   }
+
+   void Writer::PutU32(uint32_t value) {
+      mBuffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+   }
+
+   void Writer::PutU64(uint64_t value) {
+      mBuffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+   }
+
+   void Writer::PutString(const std::string& value) {
+      PutString(value.data(), value.size());
+   }
+
+   void Writer::PutString(const char* value, size_t length) {
+      PutU32(static_cast<uint32_t>(length));
+      mBuffer.append(value, length);
+   }
+
+   const std::string& Writer::Buffer() const {
+      return mBuffer;
+   }
+
+   /**
+    * Appends the End section and writes the record with plain write(2) calls
+    */
+   bool Writer::WriteToFile(const std::string& path) const {
+      int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0) {
+         return false;
+      }
+      SectionHeader end{SectionType::End, 0, 0};
+      const char* data = mBuffer.data();
+      size_t remaining = mBuffer.size();
+      bool success = true;
+      while (remaining > 0) {
+         ssize_t written = write(fd, data, remaining);
+         if (written < 0 && errno == EINTR) {
+            continue;
+         }
+         if (written <= 0) {
+            success = false;
+            break;
+         }
+         data += written;
+         remaining -= written;
+      }
+      success = success && (write(fd, &end, sizeof(end)) == sizeof(end));
+      close(fd);
+      return success;
+   }
+
+   Reader::Reader(std::istream& input) : mInput(input) {
+   }
+
+   bool Reader::ReadHeader(FileHeader& header) {
+      if (!mInput.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+         mError = "truncated file header";
+         return false;
+      }
+      if (header.magic != kMagic) {
+         mError = "not a DeathKnell crash record";
+         return false;
+      }
+      if (header.version > kVersion) {
+         mError = "unsupported crash record version " + std::to_string(header.version);
+         return false;
+      }
+      if (header.headerSize > sizeof(header)) {
+         mInput.ignore(header.headerSize - sizeof(header));
+      }
+      return true;
+   }
+
+   /**
+    * @return false at the End section or on error, check @ref Error to tell them apart
+    */
+   bool Reader::Next(SectionHeader& section, std::string& payload) {
+      if (!mInput.read(reinterpret_cast<char*>(&section), sizeof(section))) {
+         mError = "truncated section header";
+         return false;
+      }
+      if (section.type == End) {
+         return false;
+      }
+      if (section.length > kMaxSectionLength) {
+         mError = "section length " + std::to_string(section.length) + " exceeds limit";
+         return false;
+      }
+      payload.resize(section.length);
+      if (section.length > 0 && !mInput.read(&payload[0], section.length)) {
+         mError = "truncated section payload";
+         return false;
+      }
+      return true;
+   }
+
+   const std::string& Reader::Error() const {
+      return mError;
+   }
+
+   PayloadCursor::PayloadCursor(const std::string& payload) : mPayload(payload), mPosition(0) {
+   }
+
+   bool PayloadCursor::Get(void* value, size_t size) {
+      if (mPosition + size > mPayload.size()) {
+         return false;
+      }
+      memcpy(value, mPayload.data() + mPosition, size);
+      mPosition += size;
+      return true;
+   }
+
+   bool PayloadCursor::GetU8(uint8_t& value) {
+      return Get(&value, sizeof(value));
+   }
+
+   bool PayloadCursor::GetU16(uint16_t& value) {
+      return Get(&value, sizeof(value));
+   }
+
+   bool PayloadCursor::GetU32(uint32_t& value) {
+      return Get(&value, sizeof(value));
+   }
+
+   bool PayloadCursor::GetU64(uint64_t& value) {
+      return Get(&value, sizeof(value));
+   }
+
+   bool PayloadCursor::GetString(std::string& value) {
+      uint32_t length = 0;
+      if (!GetU32(length) || mPosition + length > mPayload.size()) {
+         return false;
+      }
+      value.assign(mPayload, mPosition, length);
+      mPosition += length;
+      return true;
+   }
+
+   bool PayloadCursor::AtEnd() const {
+      return mPosition == mPayload.size();
+   }
+
+   std::string SectionName(uint16_t type) {
+      switch (type) {
+         case Fatal: return "fatal";
+         case Timings: return "timings";
+         case Callbacks: return "callbacks";
+         case Breadcrumbs: return "breadcrumbs";
+         case RawStack: return "raw_stack";
+         case MemoryReserve: return "memory_reserve";
+         case Arena: return "arena";
+         case Exception: return "exception";
+         case ThreadContext: return "thread_context";
+         case Threads: return "threads";
+         case Freeze: return "freeze";
+         case DurableRegions: return "durable_regions";
+         case Sockets: return "sockets";
+         case Spill: return "spill";
+         default: return "unknown";
+      }
+   }
+
+   std::string StageName(uint16_t stage) {
+      switch (stage) {
+         case StageTotal: return "total";
+         case StageLockAcquire: return "lock_acquire";
+         case StageMessageCapture: return "message_capture";
+         case StageCallback: return "callback";
+         case StageLogPush: return "log_push";
+         case StageExit: return "exit";
+         case StageFreeze: return "freeze";
+         case StageDurableFlush: return "durable_flush";
+         case StageSpill: return "spill";
+         case StageThreadCallback: return "thread_callback";
+         default: return "stage_" + std::to_string(stage);
+      }
+   }
+
+   bool ToJson(std::istream& input, std::ostream& output, std::string& error) {
+      Reader reader(input);
+      FileHeader header;
+      if (!reader.ReadHeader(header)) {
+         error = reader.Error();
+         return false;
+      }
+      output << "{\"version\":" << header.version << ",\"pid\":" << header.pid
+              << ",\"realtime_ns\":" << header.realtimeNs << ",\"sections\":[";
+
+      SectionHeader section;
+      std::string payload;
+      bool first = true;
+      while (reader.Next(section, payload)) {
+         output << (first ? "" : ",") << "\n{\"type\":";
+         JsonString(output, SectionName(section.type));
+         if (!SectionToJson(section.type, payload, output)) {
+            error = "malformed " + SectionName(section.type) + " section";
+            return false;
+         }
+         output << "}";
+         first = false;
+      }
+      if (!reader.Error().empty()) {
+         error = reader.Error();
+         return false;
+      }
+      output << "\n]}\n";
+      return true;
+   }
+}
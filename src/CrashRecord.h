@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <istream>
+#include <ostream>
+
+/**
+ * Compact binary crash record written by @ref Death::Received
+ *
+ * Layout, host byte order (x86_64, little endian):
+ *    FileHeader
+ *    SectionHeader + payload   (repeated)
+ *    SectionHeader{End, 0}
+ *
+ * Every section carries its payload length so a reader can skip section types
+ * it does not know about. New data goes into new section types, the version is
+ * only bumped if an existing layout changes.
+ *
+ * Payload primitives: fixed width integers and strings as uint32 length + bytes.
+ */
+namespace CrashRecord {
+   const uint32_t kMagic = 0x52434B44; // "DKCR"
+   const uint16_t kVersion = 1;
+
+   enum SectionType : uint16_t {
+      End = 0,
+      Fatal = 1,        // u32 signal, str level, str file, u32 line, str function, str thread, str message
+      Timings = 2,      // u32 count, {u16 stage, u16 index, u32 reserved, u64 nanoseconds}
+      Callbacks = 3,    // u32 count, {u64 address, u8 status, str argument}
+      Breadcrumbs = 4,  // u32 count, {u64 realtime ns, str text}
+      RawStack = 5,     // u32 count, {u64 frame address}
+      MemoryReserve = 6, // u64 bytes released at death, u64 bytes used by the death path
+      Arena = 7,         // u64 capacity, u64 bytes allocated from Death::Arena
+      Exception = 8,     // str mangled type name, str what(), written for std::terminate
+      ThreadContext = 9, // u32 count, {u32 tid, u8 faulting, u8 tag count, u64 tags, str label}
+      Threads = 10,      // u32 count, {u32 tid, str name, str role, u64 cpu ns}
+      Freeze = 11,       // u8 mode, u32 threads asked to stop, u32 acknowledged, u64 wait ns
+      DurableRegions = 12, // u32 count, {u8 kind, u8 status, i32 errno, u64 ns, str name}
+      Sockets = 13,      // u32 count, {u16 local port, i32 close errno}, closed with SO_LINGER{1, 0}
+      Spill = 14,        // u32 queues, u64 events, u64 bytes, i32 errno, written by SpillQueues
+   };
+
+   /// Each stage is the time since the previous stage ended, the first since handler entry
+   enum TimingStage : uint16_t {
+      StageTotal = 0,          // handler entry until the record was written
+      StageLockAcquire = 1,    // waiting for the registry lock
+      StageMessageCapture = 2, // formatting the fatal message, capturing the stack
+      StageCallback = 3,       // one registered callback, index is its registration order
+      StageLogPush = 4,        // handing the fatal to the logger, marked after the record so only in Death::Timings
+      StageExit = 5,           // from the last callback until the record is written, its last stage
+      StageFreeze = 6,         // stopping the freezable threads, only with Death::SetupDeathFreeze
+      StageDurableFlush = 7,   // waiting for DurableRegions after the callbacks, only with regions registered
+      StageSpill = 8,          // writing SpillQueues to the spill file, only with queues registered
+      StageThreadCallback = 9, // one hook of the faulting thread, index is its registration order on that thread
+   };
+
+   enum CallbackStatus : uint8_t {
+      NotRun = 0,
+      Completed = 1,
+      FatalInCallback = 2,
+      SkippedAfterFork = 3,   // registered by the parent process without kInheritOnFork
+   };
+
+#pragma pack(push, 1)
+   struct FileHeader {
+      uint32_t magic;
+      uint16_t version;
+      uint16_t headerSize;
+      uint32_t pid;
+      uint32_t reserved;
+      uint64_t realtimeNs;
+   };
+
+   struct SectionHeader {
+      uint16_t type;
+      uint16_t reserved;
+      uint32_t length;
+   };
+#pragma pack(pop)
+
+   /**
+    * Builds a record in memory. Sections are opened with @ref Begin, filled
+    * with the Put functions and closed with @ref End which patches the length.
+    */
+   class Writer {
+   public:
+      Writer();
+      void Begin(SectionType type);
+      void End();
+      void PutU8(uint8_t value);
+      void PutU16(uint16_t value);
+      void PutU32(uint32_t value);
+      void PutU64(uint64_t value);
+      void PutString(const std::string& value);
+      void PutString(const char* value, size_t length);
+
+      const std::string& Buffer() const;
+      bool WriteToFile(const std::string& path) const;
+
+   private:
+      std::string mBuffer;
+      size_t mSectionStart;
+   };
+
+   /**
+    * Streaming decoder. Only one section payload is held in memory at a time
+    */
+   class Reader {
+   public:
+      explicit Reader(std::istream& input);
+      bool ReadHeader(FileHeader& header);
+      bool Next(SectionHeader& section, std::string& payload);
+      const std::string& Error() const;
+
+   private:
+      std::istream& mInput;
+      std::string mError;
+   };
+
+   /// Bounds checked reads from a section payload
+   class PayloadCursor {
+   public:
+      explicit PayloadCursor(const std::string& payload);
+      bool GetU8(uint8_t& value);
+      bool GetU16(uint16_t& value);
+      bool GetU32(uint32_t& value);
+      bool GetU64(uint64_t& value);
+      bool GetString(std::string& value);
+      bool AtEnd() const;
+
+   private:
+      bool Get(void* value, size_t size);
+      const std::string& mPayload;
+      size_t mPosition;
+   };
+
+   std::string SectionName(uint16_t type);
+   std::string StageName(uint16_t stage);
+
+   /**
+    * Decode a record to JSON, section by section as it is read
+    * @return false if the record is malformed, @param error describes why
+    */
+   bool ToJson(std::istream& input, std::ostream& output, std::string& error);
+}
@@ -2,9 +2,130 @@
 #include <g3log/g3log.hpp>
 #include <g3log/logmessage.hpp>
 #include <unistd.h>
+#include <execinfo.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <exception>
+#include <new>
+#include <typeinfo>
+#include <cxxabi.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <iostream>
+#include <thread>
+#include <cerrno>
 #include "Death.h"
+#include "CrashRecord.h"
+#include "DeathMetrics.h"
+#include "DeathTrace.h"
+#include "DeathProbes.h"
+#include "EarlyDeath.h"
+#include "MemoryGuard.h"
+#include "DurableRegions.h"
+#include "SocketRegistry.h"
+#include "SpillQueues.h"
+#include "Watchdog.h"
 
+namespace {
+   thread_local bool gSimulating = false;
+
+   enum InstanceState : int { kNotConstructed = 0, kAlive, kDestroyed };
+   /// Constant-initialized, readable during static initialization and destruction
+   std::atomic<int> gInstanceState{kNotConstructed};
+
+   bool InstanceAlive() {
+      return gInstanceState.load(std::memory_order_acquire) == kAlive;
+   }
+
+   /// set on the thread running Received, it must not stop at its own safepoints
+   thread_local bool gHandlingDeath = false;
+
+   /// set while the calling thread holds the registry lock, a fatal raised under it must not lock again
+   thread_local bool gHoldsRegistryLock = false;
+
+   /// set between the fork handlers when PrepareFork took the registry lock
+   thread_local bool gForkLocked = false;
+
+   /// std::lock_guard for the registry lock that keeps gHoldsRegistryLock up to date
+   class RegistryLock {
+   public:
+      explicit RegistryLock(std::mutex& lock) : mLock(lock) {
+         mLock.lock();
+         gHoldsRegistryLock = true;
+      }
+
+      ~RegistryLock() {
+         gHoldsRegistryLock = false;
+         mLock.unlock();
+      }
+
+   private:
+      RegistryLock(const RegistryLock&) = delete;
+      RegistryLock& operator=(const RegistryLock&) = delete;
+
+      std::mutex& mLock;
+   };
+
+   /**
+    * Scheduling of the dying thread, kept so that it can be restored when
+    * Received returns (test mode). Every step is best effort, without
+    * CAP_SYS_NICE the realtime policy and negative nice values are refused
+    */
+   struct DeathScheduling {
+      bool applied = false;
+      int policy = SCHED_OTHER;
+      sched_param param{};
+      int nice = 0;
+      bool pinned = false;
+      cpu_set_t affinity;
+
+      void Apply(bool boostPriority, int reservedCpu) {
+         applied = true;
+         const pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+         pthread_getschedparam(pthread_self(), &policy, &param);
+         errno = 0;
+         nice = getpriority(PRIO_PROCESS, tid);
+         if (boostPriority) {
+            sched_param realtime{};
+            realtime.sched_priority = sched_get_priority_min(SCHED_FIFO);
+            if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &realtime) != 0) {
+               setpriority(PRIO_PROCESS, tid, -20);
+            }
+         }
+         if (reservedCpu >= 0 && reservedCpu < CPU_SETSIZE && sched_getaffinity(0, sizeof(affinity), &affinity) == 0) {
+            cpu_set_t reserved;
+            CPU_ZERO(&reserved);
+            CPU_SET(reservedCpu, &reserved);
+            pinned = sched_setaffinity(0, sizeof(reserved), &reserved) == 0;
+         }
+      }
+
+      void Restore() {
+         if (!applied) {
+            return;
+         }
+         pthread_setschedparam(pthread_self(), policy, &param);
+         setpriority(PRIO_PROCESS, static_cast<pid_t>(syscall(SYS_gettid)), nice);
+         if (pinned) {
+            sched_setaffinity(0, sizeof(affinity), &affinity);
+         }
+         applied = false;
+         pinned = false;
+      }
+   };
+}
+
+std::atomic<bool> Death::mPauseRequested{false};
+std::atomic<size_t> Death::mPausedThreads{0};
+
+
+thread_local std::vector<Death::DeathEvent> Death::mThreadEvents;
 
 /**
  * Singleton Instance Method
@@ -16,9 +137,20 @@ Death& Death::Instance() {
    return gInstance;
 }
 
-Death::Death() : mReceived(false), mMessage {""}, mEnableDefaultFatal(false)
+Death::Death() : mReceived(false), mMessage {""}, mPid(getpid()), mOwnedCount(0), mInheritableCount(0),
+   mEnableDefaultFatal(false), mFatal{0, "", "", 0, "", "", ""},
+   mCurrentCallback(0), mStackDepth(0), mEmergencyReserveBytes(0),
+   mBoostPriority(false), mReservedCpu(-1), mPauseThreads(false),
+   mFreezeMode(kNoFreeze), mFreezeTimeout(0), mFreezeSignal(0), mFreezeExpected(0), mFreezeAcknowledged(0),
+   mFreezeWait(0),
+   mExceptionClaimed(false), mExceptionType(nullptr), mExceptionWhat{}, mFaultingTid(0), mClosedSockets(0), mSpilled(false), mSpilling(false)
 {
+   pthread_atfork(&Death::PrepareFork, &Death::ParentAfterFork, &Death::ChildAfterFork);
+   gInstanceState.store(kAlive, std::memory_order_release);
+}
 
+Death::~Death() {
+   gInstanceState.store(kDestroyed, std::memory_order_release);
 }
 
 /**
@@ -47,46 +179,175 @@ void Death::EnableDefaultFatalCall() {
 /// @param death message with any captured death details
 
 void Death::Received(g3::FatalMessagePtr death) {
-
+   const auto entryTime = std::chrono::steady_clock::now();
    thread_local bool recursiveDeathDetect = false;
+   DK_PROBE1(received_enter, static_cast<int>(death.get()->_signal_id));
+   if (gInstanceState.load(std::memory_order_acquire) == kDestroyed) {
+      // during static destruction, the hooks and their state are gone
+      EarlyDeath::Fatal(death.get()->message().c_str());
+   }
+   if (gHoldsRegistryLock && !recursiveDeathDetect) {
+      // raised by Death itself under the registry lock, e.g. an allocation failure while
+      // registering, locking again would deadlock. The message is not copied, allocation may fail
+      EarlyDeath::Fatal(death.get()->write().c_str());
+   }
+
+   // boost before contending for the registry lock, restored if we return
+   thread_local DeathScheduling scheduling;
+   gHandlingDeath = true;
+   if (!recursiveDeathDetect) {
+      if (Death::Instance().mBoostPriority || Death::Instance().mReservedCpu >= 0) {
+         scheduling.Apply(Death::Instance().mBoostPriority, Death::Instance().mReservedCpu);
+      }
+      if (Death::Instance().mPauseThreads) {
+         mPauseRequested.store(true, std::memory_order_relaxed);
+      }
+   }
 
    // lambda for quick exit
    auto clearCallbacksThenFatalExit = [&](g3::FatalMessagePtr death) {
+      Death::Instance().MarkStage(CrashRecord::StageExit);
+      Death::Instance().WriteCrashRecord();
+      const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - Death::Instance().mEntryTime);
+      DeathMetrics::Block().lastDeathNs.store(elapsed.count(), std::memory_order_relaxed);
+      if (DeathTrace::IsEnabled()) {
+         DeathTrace::Record(DeathTrace::kDeath, CrashRecord::StageTotal, 0, 0,
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Death::Instance().mEntryTime.time_since_epoch()).count(), elapsed.count());
+         DeathTrace::Flush();
+      }
+      DK_PROBE1(received_exit, static_cast<int>(death.get()->_signal_id));
       if (Death::Instance().mEnableDefaultFatal) {
          ClearExits();
          g3::internal::pushFatalMessageToLogger(death);
       }
+      Death::Instance().MarkStage(CrashRecord::StageLogPush);
+      mPauseRequested.store(false, std::memory_order_relaxed);
+      scheduling.Restore();
+      gHandlingDeath = false;
       recursiveDeathDetect = false; // reset for test purposes
    };
 
    // Recursive fatal was discovered
    if (Death::Instance().mReceived  && recursiveDeathDetect) {
       std::cerr << "Recursive crash detected. Aborting death-hook calls" << std::endl;
+      auto& status = Death::Instance().mCallbackStatus;
+      if (Death::Instance().mSpilling) {
+         // a queue cursor raised it, LastSpill shows the spill as interrupted
+         Death::Instance().mSpilling = false;
+         Death::Instance().MarkStage(CrashRecord::StageSpill);
+      } else if (Death::Instance().mCurrentCallback < status.size()) {
+         status[Death::Instance().mCurrentCallback] = CrashRecord::FatalInCallback;
+         Death::Instance().MarkStage(CrashRecord::StageCallback, Death::Instance().mCurrentCallback);
+      }
       clearCallbacksThenFatalExit(death);
       return;
    }
 
 
-   std::lock_guard<std::mutex> glock(Death::Instance().mListLock);
+   RegistryLock glock(Death::Instance().mListLock);
+   auto& shutdownFunctions = Death::Instance().mShutdownFunctions;
+   Death::Instance().mEntryTime = entryTime;
+   Death::Instance().mLastMark = entryTime;
+   Death::Instance().mTimings.clear();
+   Death::Instance().mTimings.reserve(shutdownFunctions.size() + mThreadEvents.size() + 8);
+   Death::Instance().MarkStage(CrashRecord::StageLockAcquire);
+   Death::Instance().mEmergencyReserve.Release();
+   // free the ports for the replacement process as early as possible
+   Death::Instance().mClosedSockets = SocketRegistry::AbortAll();
+   DeathMetrics::Block().deaths.fetch_add(1, std::memory_order_relaxed);
    Death::Instance().mReceived = true;
    auto crashReason = death.get()->toString();
    Death::Instance().mMessage = crashReason;
+   Death::Instance().CaptureFatal(*death.get());
+   Death::Instance().mFaultingTid = static_cast<pid_t>(syscall(SYS_gettid));
+   ThreadContext::Snapshot(Death::Instance().mThreadContexts);
+   Death::Instance().MarkStage(CrashRecord::StageMessageCapture);
+   if (Death::Instance().mFreezeMode != kNoFreeze) {
+      Death::Instance().FreezeThreads();
+      Death::Instance().MarkStage(CrashRecord::StageFreeze);
+   }
+   // user code runs from here on, a fatal in it takes the recursive path above
+   Death::Instance().mCallbackStatus.assign(shutdownFunctions.size(), CrashRecord::NotRun);
+   Death::Instance().mCurrentCallback = shutdownFunctions.size();
    recursiveDeathDetect = true;
-   for (const auto& deathFunction : Death::Instance().mShutdownFunctions) {
+   // queued events are spilled while frozen threads cannot change them, before callbacks tear down
+   Death::Instance().mSpilled = SpillQueues::HasQueues();
+   if (Death::Instance().mSpilled) {
+      Death::Instance().mSpilling = true;
+      SpillQueues::SpillAll();
+      Death::Instance().mSpilling = false;
+      Death::Instance().MarkStage(CrashRecord::StageSpill);
+   }
+   // durable regions flush on their workers while the callbacks run
+   const size_t durableRegions = DurableRegions::Begin();
+   // the faulting thread's own hooks first, a fatal in one is not attributed to a global hook
+   for (size_t index = 0; index < mThreadEvents.size(); ++index) {
+      const DeathEvent event = mThreadEvents[index];
+      if (Death::Instance().IsOwned(event)) {
+         DK_PROBE3(callback_enter, reinterpret_cast<void*>(event.function), event.argument.c_str(), 1);
+         (event.function)(event.argument);
+         DK_PROBE3(callback_return, reinterpret_cast<void*>(event.function), event.argument.c_str(), 1);
+         Death::Instance().MarkStage(CrashRecord::StageThreadCallback, index);
+      }
+   }
+   for (size_t index = 0; index < shutdownFunctions.size(); ++index) {
       // semi-dangerous in case one function would trigger another FATAL
       // as long as it is in the same thread then we will capture that above
-      (deathFunction.first)(deathFunction.second); 
+      Death::Instance().mCurrentCallback = index;
+      const auto& event = shutdownFunctions[index];
+      if (!Death::Instance().IsOwned(event)) {
+         Death::Instance().mCallbackStatus[index] = CrashRecord::SkippedAfterFork;
+         continue;
+      }
+      DK_PROBE3(callback_enter, reinterpret_cast<void*>(event.function), event.argument.c_str(), 0);
+      (event.function)(event.argument);
+      DK_PROBE3(callback_return, reinterpret_cast<void*>(event.function), event.argument.c_str(), 0);
+      if (Death::Instance().mCallbackStatus[index] == CrashRecord::NotRun) {
+         Death::Instance().mCallbackStatus[index] = CrashRecord::Completed;
+         Death::Instance().MarkStage(CrashRecord::StageCallback, index);
+      }
+   }
+   EarlyDeath::RunEvents();
+   if (durableRegions > 0) {
+      DurableRegions::Finish();
+      Death::Instance().MarkStage(CrashRecord::StageDurableFlush);
    }
    clearCallbacksThenFatalExit(death);
 }
 
 /**
  * Register a DeathCallback into the set of functions that will be called
- * @return 
+ * @param flags see DeathEventFlags
+ */
+void Death::RegisterDeathEvent(DeathCallbackType deathFunction, const DeathCallbackArg& deathArg, uint32_t flags) {
+   RegistryLock glock(Death::Instance().mListLock);
+   DK_PROBE2(register_event, reinterpret_cast<void*>(deathFunction), deathArg.c_str());
+   Death::Instance().mShutdownFunctions.push_back({deathFunction, deathArg, flags, Death::Instance().mPid});
+   Death::Instance().mOwnedCount++;
+   if (flags & kInheritOnFork) {
+      Death::Instance().mInheritableCount++;
+   }
+   auto& metrics = DeathMetrics::Block();
+   metrics.registrations.fetch_add(1, std::memory_order_relaxed);
+   metrics.registeredHooks.store(Death::Instance().mOwnedCount, std::memory_order_relaxed);
+}
+
+/**
+ * Register a DeathCallback that runs only if the fatal happens on the calling
+ * thread, before the global ones. Lock free, the entries are dropped when the
+ * thread exits
+ * @param flags see DeathEventFlags, kDryRunCapable is not used since
+ *    @ref Simulate covers the global registry only
  */
-void Death::RegisterDeathEvent(DeathCallbackType deathFunction, const DeathCallbackArg& deathArg) {
-   std::lock_guard<std::mutex> glock(Death::Instance().mListLock);
-   Death::Instance().mShutdownFunctions.push_back(std::make_pair(deathFunction,deathArg));
+void Death::RegisterThreadDeathEvent(DeathCallbackType deathFunction, const DeathCallbackArg& deathArg, uint32_t flags) {
+   mThreadEvents.push_back({deathFunction, deathArg, flags, Death::Instance().mPid});
+}
+
+/// Drop the calling thread's hooks, @ref ClearExits does the same
+void Death::ClearThreadExits() {
+   mThreadEvents.clear();
 }
 
 bool Death::WasKilled() {
@@ -96,16 +357,543 @@ bool Death::WasKilled() {
 /// Please call this if you plan on doing DEATH tests. 
 
 void Death::SetupExitHandler() {
+   // the first backtrace call may load libgcc, do it now rather than at death
+   void* frame[1];
+   backtrace(frame, 1);
+   {
+      RegistryLock glock(Death::Instance().mListLock);
+      auto& reserve = Death::Instance().mEmergencyReserve;
+      if (Death::Instance().mEmergencyReserveBytes > 0 && reserve.Size() == 0) {
+         reserve.Reserve(Death::Instance().mEmergencyReserveBytes);
+      }
+      Death::Instance().mThreadContexts.reserve(ThreadContext::kMaxThreads);
+   }
    g3::setFatalExitHandler(Death::Received);
 }
 
+/**
+ * As @ref SetupExitHandler and set aside @param emergencyReserveBytes that are
+ * given back to the kernel when a fatal is received, before any message formatting
+ * or callback runs. 0 removes the reserve
+ * @param processHandlers also route allocation failures and std::terminate
+ *    through @ref Received, see ProcessHandlers
+ */
+void Death::SetupExitHandler(size_t emergencyReserveBytes, uint32_t processHandlers) {
+   {
+      RegistryLock glock(Death::Instance().mListLock);
+      Death::Instance().mEmergencyReserveBytes = emergencyReserveBytes;
+      Death::Instance().mEmergencyReserve.Release();
+   }
+   SetupExitHandler();
+   if (processHandlers & kHandleAllocationFailure) {
+      std::set_new_handler(&Death::AllocationFailed);
+   }
+   if (processHandlers & kHandleTerminate) {
+      std::set_terminate(&Death::Terminated);
+   }
+}
+
+/**
+ * new-handler: hand the emergency reserve back to the kernel so the death path can
+ * allocate, then die. A failure inside Death under the registry lock dies through
+ * EarlyDeath::Fatal instead, see @ref Received. If the fatal returns (test mode) the allocation fails
+ * with std::bad_alloc as it would have without the handler
+ */
+void Death::AllocationFailed() {
+   Death::Instance().mEmergencyReserve.Release();
+   std::set_new_handler(nullptr);
+   SyntheticFatal(__FILE__, __LINE__, __func__, "Allocation failure: operator new could not allocate");
+   throw std::bad_alloc();
+}
+
+/**
+ * terminate handler: the exception type is taken from the typeinfo without
+ * demangling, deathknell-inspect demangles it. Never returns
+ */
+void Death::Terminated() {
+   const std::type_info* type = abi::__cxa_current_exception_type();
+   std::string what;
+   if (type != nullptr) {
+      try {
+         throw;
+      } catch (const std::exception& exception) {
+         what = exception.what();
+      } catch (...) {
+      }
+   }
+   // no registry lock, this thread may already hold it. The first thread to terminate is recorded
+   bool expected = false;
+   if (type != nullptr && Death::Instance().mExceptionClaimed.compare_exchange_strong(expected, true)) {
+      const size_t length = std::min(what.size(), sizeof(Death::Instance().mExceptionWhat) - 1);
+      memcpy(Death::Instance().mExceptionWhat, what.data(), length);
+      Death::Instance().mExceptionWhat[length] = '\0';
+      Death::Instance().mExceptionType.store(type->name(), std::memory_order_release);
+   }
+   std::string reason = "std::terminate called";
+   if (type != nullptr) {
+      reason.append(" with uncaught exception of type ").append(type->name());
+      if (!what.empty()) {
+         reason.append(": ").append(what);
+      }
+   }
+   SyntheticFatal(__FILE__, __LINE__, __func__, reason);
+   std::abort();
+}
+
+/// Bytes of the emergency reserve the last death path used, net
+size_t Death::EmergencyReserveUsed() {
+   RegistryLock glock(Death::Instance().mListLock);
+   return Death::Instance().mEmergencyReserve.Used();
+}
+
+/**
+ * mmap @param bytes of scratch memory for death callbacks, see @ref Arena.
+ * Call during setup, 0 unmaps the arena
+ */
+bool Death::SetupDeathArena(size_t bytes) {
+   RegistryLock glock(Death::Instance().mListLock);
+   return Death::Instance().mArena.Map(bytes);
+}
+
+/**
+ * Scratch memory for death callbacks that does not depend on the global heap,
+ * e.g. Death::Arena().Format("%s/%d.spill", dir, id)
+ */
+DeathArena& Death::Arena() {
+   return Death::Instance().mArena;
+}
+
+/// Drops the global hooks, the calling thread's hooks and the breadcrumbs
 void Death::ClearExits() {
+   DK_PROBE1(clear_exits, Death::Instance().mShutdownFunctions.size());
    Death::Instance().mReceived = false;
    Death::Instance().mMessage = "";
    Death::Instance().mShutdownFunctions.clear();
+   mThreadEvents.clear();
+   Death::Instance().mOwnedCount = 0;
+   Death::Instance().mInheritableCount = 0;
+   Death::Instance().mArena.Reset();
+   Death::Instance().mBreadcrumbs.Clear();
+   Death::Instance().mExceptionType.store(nullptr);
+   Death::Instance().mExceptionWhat[0] = '\0';
+   Death::Instance().mExceptionClaimed.store(false);
+   DeathMetrics::Block().clearExits.fetch_add(1, std::memory_order_relaxed);
+   DeathMetrics::Block().registeredHooks.store(0, std::memory_order_relaxed);
 }
 
  std::string Death::Message() {
     return Death::Instance().mMessage;
  }
 
+
+/**
+ * Write a binary crash record to @param path when a fatal is received.
+ * An empty path disables the record. See CrashRecord.h for the format
+ */
+void Death::SetCrashRecordPath(const std::string& path) {
+   RegistryLock glock(Death::Instance().mListLock);
+   Death::Instance().mCrashRecordPath = path;
+}
+
+/**
+ * Leave a short note that is included in the crash record. Lock free,
+ * only the most recent @ref Breadcrumbs::kCapacity are kept
+ */
+void Death::LeaveBreadcrumb(const std::string& crumb) {
+   Death::Instance().mBreadcrumbs.Leave(crumb.data(), crumb.size());
+}
+
+/// Keep the fatal details and the faulting stack for the crash record
+void Death::CaptureFatal(const g3::FatalMessage& fatal) {
+   mFatal.signal = static_cast<uint32_t>(fatal._signal_id);
+   mFatal.level = fatal.level();
+   mFatal.file = fatal.file();
+   mFatal.line = static_cast<uint32_t>(std::strtoul(fatal.line().c_str(), nullptr, 10));
+   mFatal.function = fatal.function();
+   mFatal.thread = fatal.threadID();
+   mFatal.message = fatal.message();
+   mStackDepth = backtrace(mStackFrames.data(), mStackFrames.size());
+}
+
+/// Called with mListLock held, from the fatal or recursive fatal path
+void Death::WriteCrashRecord() {
+   if (mCrashRecordPath.empty()) {
+      return;
+   }
+   CrashRecord::Writer record;
+   record.Begin(CrashRecord::Fatal);
+   record.PutU32(mFatal.signal);
+   record.PutString(mFatal.level);
+   record.PutString(mFatal.file);
+   record.PutU32(mFatal.line);
+   record.PutString(mFatal.function);
+   record.PutString(mFatal.thread);
+   record.PutString(mFatal.message);
+
+   record.Begin(CrashRecord::Callbacks);
+   record.PutU32(mShutdownFunctions.size());
+   for (size_t index = 0; index < mShutdownFunctions.size(); ++index) {
+      record.PutU64(reinterpret_cast<uint64_t>(mShutdownFunctions[index].function));
+      record.PutU8(index < mCallbackStatus.size() ? mCallbackStatus[index]
+              : static_cast<uint8_t>(CrashRecord::NotRun));
+      record.PutString(mShutdownFunctions[index].argument);
+   }
+
+   record.Begin(CrashRecord::Breadcrumbs);
+   const auto crumbs = mBreadcrumbs.Collect();
+   record.PutU32(crumbs.size());
+   for (const auto& crumb : crumbs) {
+      record.PutU64(crumb.realtimeNs);
+      record.PutString(crumb.text);
+   }
+
+   record.Begin(CrashRecord::ThreadContext);
+   record.PutU32(mThreadContexts.size());
+   for (const auto& context : mThreadContexts) {
+      record.PutU32(context.tid);
+      record.PutU8(context.tid == mFaultingTid);
+      record.PutU8(ThreadContextSlot::kTags);
+      for (const uint64_t tag : context.tags) {
+         record.PutU64(tag);
+      }
+      if (context.label != nullptr) {
+         record.PutString(context.label, strnlen(context.label, ThreadContext::kLabelSize));
+      } else {
+         record.PutString("");
+      }
+   }
+
+   record.Begin(CrashRecord::Threads);
+   record.PutU32(mThreadContexts.size());
+   for (const auto& context : mThreadContexts) {
+      record.PutU32(context.tid);
+      record.PutString(context.name, strlen(context.name));
+      const char* role = context.role != nullptr ? context.role : "";
+      record.PutString(role, strnlen(role, ThreadContext::kLabelSize));
+      record.PutU64(context.cpuNs);
+   }
+
+   record.Begin(CrashRecord::RawStack);
+   record.PutU32(mStackDepth);
+   for (int frame = 0; frame < mStackDepth; ++frame) {
+      record.PutU64(reinterpret_cast<uint64_t>(mStackFrames[frame]));
+   }
+
+   if (mFreezeMode != kNoFreeze) {
+      record.Begin(CrashRecord::Freeze);
+      record.PutU8(mFreezeMode);
+      record.PutU32(mFreezeExpected);
+      record.PutU32(mFreezeAcknowledged);
+      record.PutU64(mFreezeWait.count());
+   }
+
+   if (mClosedSockets > 0) {
+      const auto sockets = SocketRegistry::LastClosed();
+      record.Begin(CrashRecord::Sockets);
+      record.PutU32(sockets.size());
+      for (const auto& socket : sockets) {
+         record.PutU16(socket.port);
+         record.PutU32(static_cast<uint32_t>(socket.error));
+      }
+   }
+
+   if (mSpilled) {
+      const auto spill = SpillQueues::LastSpill();
+      record.Begin(CrashRecord::Spill);
+      record.PutU32(spill.queues);
+      record.PutU64(spill.events);
+      record.PutU64(spill.bytes);
+      record.PutU32(static_cast<uint32_t>(spill.error));
+   }
+
+   const auto regions = DurableRegions::Results();
+   if (!regions.empty()) {
+      record.Begin(CrashRecord::DurableRegions);
+      record.PutU32(regions.size());
+      for (const auto& region : regions) {
+         record.PutU8(region.kind);
+         record.PutU8(region.status);
+         record.PutU32(static_cast<uint32_t>(region.error));
+         record.PutU64(region.duration.count());
+         record.PutString(region.name);
+      }
+   }
+
+   record.Begin(CrashRecord::MemoryReserve);
+   record.PutU64(mEmergencyReserve.Released());
+   record.PutU64(mEmergencyReserve.Used());
+
+   const char* exceptionType = mExceptionType.load(std::memory_order_acquire);
+   if (exceptionType != nullptr) {
+      record.Begin(CrashRecord::Exception);
+      record.PutString(exceptionType, strlen(exceptionType));
+      record.PutString(mExceptionWhat, strlen(mExceptionWhat));
+   }
+
+   record.Begin(CrashRecord::Arena);
+   record.PutU64(mArena.Capacity());
+   record.PutU64(mArena.Used());
+
+   const auto elapsed = std::chrono::steady_clock::now() - mEntryTime;
+   record.Begin(CrashRecord::Timings);
+   record.PutU32(mTimings.size() + 1);
+   for (const auto& timing : mTimings) {
+      record.PutU16(timing.stage);
+      record.PutU16(timing.index);
+      record.PutU32(0);
+      record.PutU64(timing.duration.count());
+   }
+   record.PutU16(CrashRecord::StageTotal);
+   record.PutU16(0);
+   record.PutU32(0);
+   record.PutU64(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+   record.End();
+
+   if (!record.WriteToFile(mCrashRecordPath)) {
+      std::cerr << "Failed to write crash record to " << mCrashRecordPath << std::endl;
+   }
+}
+
+/**
+ * Per stage durations of the most recent death, see CrashRecord::TimingStage.
+ * Kept across @ref ClearExits so tests and dry runs can look at them afterwards.
+ * Takes the registry lock, do not call it from a death callback
+ */
+Death::LatencyReport Death::Timings() {
+   RegistryLock glock(Death::Instance().mListLock);
+   return Death::Instance().mTimings;
+}
+
+/// Close the current stage, monotonic clock. Called with mListLock held
+void Death::MarkStage(uint16_t stage, uint16_t index) {
+   const auto now = std::chrono::steady_clock::now();
+   const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(now - mLastMark);
+   mTimings.push_back({stage, index, duration});
+   if (DeathTrace::IsEnabled()) {
+      uint64_t address = 0;
+      if (stage == CrashRecord::StageCallback && index < mShutdownFunctions.size()) {
+         address = reinterpret_cast<uint64_t>(mShutdownFunctions[index].function);
+      } else if (stage == CrashRecord::StageThreadCallback && index < mThreadEvents.size()) {
+         address = reinterpret_cast<uint64_t>(mThreadEvents[index].function);
+      }
+      DeathTrace::Record(DeathTrace::kDeath, stage, index, address,
+              std::chrono::duration_cast<std::chrono::nanoseconds>(mLastMark.time_since_epoch()).count(),
+              duration.count());
+   }
+   mLastMark = now;
+}
+
+/**
+ * Dry run of the death sequence. Only callbacks registered with kDryRunCapable
+ * are invoked, nothing is marked as received and the process keeps running.
+ * The callbacks run outside the registry lock so a real fatal from one of them
+ * is handled as usual.
+ * @return lock acquisition, one StageCallback per invoked callback and the total.
+ * With DeathTrace enabled the callbacks are recorded too, DeathTrace::Flush writes them
+ */
+Death::LatencyReport Death::Simulate() {
+   const auto start = std::chrono::steady_clock::now();
+   std::vector<std::pair<size_t, DeathEvent>> dryRunEvents;
+   {
+      RegistryLock glock(Death::Instance().mListLock);
+      const auto& shutdownFunctions = Death::Instance().mShutdownFunctions;
+      for (size_t index = 0; index < shutdownFunctions.size(); ++index) {
+         if ((shutdownFunctions[index].flags & kDryRunCapable) && Death::Instance().IsOwned(shutdownFunctions[index])) {
+            dryRunEvents.emplace_back(index, shutdownFunctions[index]);
+         }
+      }
+   }
+
+   LatencyReport report;
+   report.reserve(dryRunEvents.size() + 2);
+   auto lastMark = std::chrono::steady_clock::now();
+   report.push_back({CrashRecord::StageLockAcquire, 0, lastMark - start});
+   gSimulating = true;
+   for (const auto& event : dryRunEvents) {
+      (event.second.function)(event.second.argument);
+      const auto now = std::chrono::steady_clock::now();
+      report.push_back({CrashRecord::StageCallback, static_cast<uint16_t>(event.first), now - lastMark});
+      DeathTrace::Record(DeathTrace::kSimulation, CrashRecord::StageCallback, static_cast<uint16_t>(event.first),
+              reinterpret_cast<uint64_t>(event.second.function),
+              std::chrono::duration_cast<std::chrono::nanoseconds>(lastMark.time_since_epoch()).count(),
+              std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastMark).count());
+      lastMark = now;
+   }
+   gSimulating = false;
+   report.push_back({CrashRecord::StageTotal, 0, lastMark - start});
+   DeathTrace::Record(DeathTrace::kSimulation, CrashRecord::StageTotal, 0, 0,
+           std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count(),
+           std::chrono::duration_cast<std::chrono::nanoseconds>(lastMark - start).count());
+   DeathMetrics::RecordSimulation(std::chrono::duration_cast<std::chrono::nanoseconds>(lastMark - start).count());
+   return report;
+}
+
+/// Registered in this process, or inherited from a parent with kInheritOnFork
+bool Death::IsOwned(const DeathEvent& event) const {
+   return event.owner == mPid || (event.flags & kInheritOnFork);
+}
+
+/**
+ * fork() must not snapshot the registry while another thread is changing it.
+ * A thread that already holds the lock, e.g. a death callback calling fork(),
+ * keeps it and no other thread can change the registry meanwhile
+ */
+void Death::PrepareFork() {
+   if (InstanceAlive() && !gHoldsRegistryLock) {
+      Death::Instance().mListLock.lock();
+      gForkLocked = true;
+   }
+}
+
+void Death::ParentAfterFork() {
+   if (gForkLocked) {
+      gForkLocked = false;
+      Death::Instance().mListLock.unlock();
+   }
+}
+
+/**
+ * The child keeps the parent's entries in place, copy-on-write, and only
+ * changes its pid so that entries registered by the parent without
+ * kInheritOnFork are skipped. No entry is touched. ThreadContext drops the
+ * parent's threads, SocketRegistry and SpillQueues skip the parent's sockets
+ * and spill file by pid. Helper threads are not copied by fork(), the
+ * Watchdog and MemoryGuard monitors and the DurableRegions workers are
+ * forgotten without a join so they can be started again in the child
+ */
+void Death::ChildAfterFork() {
+   Watchdog::AfterFork();
+   MemoryGuard::AfterFork();
+   DurableRegions::AfterFork();
+   if (!InstanceAlive()) {
+      return;
+   }
+   Death& death = Death::Instance();
+   death.mPid = getpid();
+   death.mOwnedCount = death.mInheritableCount;
+   DeathMetrics::UseProcessLocalBlock();
+   DeathMetrics::Block().registeredHooks.store(death.mOwnedCount, std::memory_order_relaxed);
+   ThreadContext::AfterFork();
+   if (gForkLocked) {
+      gForkLocked = false;
+      death.mListLock.unlock();
+   }
+}
+
+/**
+ * Make the thread that handles a fatal finish quickly on a saturated host
+ * @param boostPriority SCHED_FIFO, or the lowest nice value if that is refused
+ * @param reservedCpu pin the dying thread to this CPU, -1 leaves affinity alone
+ * @param pauseThreads threads calling @ref Safepoint block until the process exits
+ * Configure at startup, Received reads these before taking the registry lock
+ * @return false if @param reservedCpu is at or above CPU_SETSIZE, affinity is then left alone
+ */
+bool Death::SetupDeathScheduling(bool boostPriority, int reservedCpu, bool pauseThreads) {
+   const bool validCpu = reservedCpu < CPU_SETSIZE;
+   Death::Instance().mBoostPriority = boostPriority;
+   Death::Instance().mReservedCpu = validCpu ? reservedCpu : -1;
+   Death::Instance().mPauseThreads = pauseThreads;
+   return validCpu;
+}
+
+/// Cold part of @ref Safepoint, polls so that no lock is shared with the dying thread
+void Death::WaitWhilePaused() {
+   if (gHandlingDeath) {
+      return;
+   }
+   mPausedThreads.fetch_add(1, std::memory_order_relaxed);
+   while (mPauseRequested.load(std::memory_order_relaxed)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   mPausedThreads.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/**
+ * Stop every thread that called ThreadContext::SetFreezable(true) while the
+ * death callbacks run, so they flush state nobody is changing.
+ * kFreezeBySignal can stop a thread inside malloc or holding a lock a callback
+ * needs, prefer kFreezeAtSafepoint for threads that have safepoints.
+ * @param acknowledgeTimeout how long Received waits for the threads to stop,
+ *    callbacks run regardless
+ * @param signal for kFreezeBySignal, 0 picks SIGRTMIN + 3
+ * @return false if the signal handler could not be installed
+ */
+bool Death::SetupDeathFreeze(FreezeMode mode, std::chrono::milliseconds acknowledgeTimeout, int signal) {
+   if (mode == kFreezeBySignal) {
+      signal = (signal == 0) ? SIGRTMIN + 3 : signal;
+      struct sigaction action {};
+      action.sa_handler = &Death::FreezeSignalReceived;
+      sigemptyset(&action.sa_mask);
+      action.sa_flags = SA_RESTART;
+      if (sigaction(signal, &action, nullptr) != 0) {
+         return false;
+      }
+   }
+   RegistryLock glock(Death::Instance().mListLock);
+   Death::Instance().mFreezeMode = mode;
+   Death::Instance().mFreezeTimeout = acknowledgeTimeout;
+   Death::Instance().mFreezeSignal = signal;
+   return true;
+}
+
+/// Parks an interrupted thread, only async-signal-safe calls
+void Death::FreezeSignalReceived(int) {
+   const int savedErrno = errno;
+   mPausedThreads.fetch_add(1, std::memory_order_relaxed);
+   const timespec pause{0, 1000000};
+   while (mPauseRequested.load(std::memory_order_relaxed)) {
+      nanosleep(&pause, nullptr);
+   }
+   mPausedThreads.fetch_sub(1, std::memory_order_relaxed);
+   errno = savedErrno;
+}
+
+/// Ask the freezable threads in the context snapshot to stop and wait for them
+void Death::FreezeThreads() {
+   const auto start = std::chrono::steady_clock::now();
+   mFreezeExpected = 0;
+   mPauseRequested.store(true, std::memory_order_relaxed);
+   for (const auto& context : mThreadContexts) {
+      if (!context.freezable || context.tid == mFaultingTid) {
+         continue;
+      }
+      ++mFreezeExpected;
+      if (mFreezeMode == kFreezeBySignal) {
+         syscall(SYS_tgkill, mPid, context.tid, mFreezeSignal);
+      }
+   }
+   const auto deadline = start + mFreezeTimeout;
+   while (PausedThreads() < mFreezeExpected && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+   }
+   mFreezeAcknowledged = std::min<uint32_t>(PausedThreads(), mFreezeExpected);
+   mFreezeWait = std::chrono::steady_clock::now() - start;
+}
+
+/// @return threads currently blocked in @ref Safepoint
+size_t Death::PausedThreads() {
+   return mPausedThreads.load(std::memory_order_relaxed);
+}
+
+/// @return true while the calling thread is inside @ref Simulate
+bool Death::IsSimulating() {
+   return gSimulating;
+}
+
+/**
+ * Raise a fatal that did not come from g3log, it goes through the same
+ * @ref Received path as a failed CHECK. Before the logger is initialized or
+ * after Death is destroyed it takes the @ref EarlyDeath::Fatal path instead
+ */
+void Death::SyntheticFatal(const char* file, int line, const char* function, const std::string& reason) {
+   if (!InstanceAlive() || !g3::internal::isLoggingInitialized()) {
+      // before main or after static destruction, no logger to push the fatal to
+      char text[512];
+      snprintf(text, sizeof(text), "%s:%d %s: %s", file, line, function, reason.c_str());
+      EarlyDeath::Fatal(text);
+   }
+   g3::LogMessage details(file, line, function, FATAL);
+   details.write().append(reason);
+   g3::FatalMessagePtr fatal{std::unique_ptr<g3::FatalMessage>(new g3::FatalMessage(details, SIGABRT))};
+   Received(fatal);
+}
@@ -5,6 +5,14 @@
 #include <mutex>
 #include <vector>
 #include <functional>
+#include <chrono>
+#include <array>
+#include <atomic>
+#include <sys/types.h>
+#include "Breadcrumbs.h"
+#include "EmergencyReserve.h"
+#include "DeathArena.h"
+#include "ThreadContext.h"
 
 /**
  * By calling @ref UseDeathHandler all CHECK, LOG(FATAL) or fatal signals will be caught by g2log
@@ -18,25 +26,148 @@ public:
    using DeathCallbackArg = std::string;
    using DeathCallbackType = void (*)(const DeathCallbackArg& arg);
 
+   struct StageTiming {
+      uint16_t stage;   // CrashRecord::TimingStage
+      uint16_t index;   // registration order for CrashRecord::StageCallback
+      std::chrono::nanoseconds duration;
+   };
+   using LatencyReport = std::vector<StageTiming>;
+
+   enum ProcessHandlers : uint32_t {
+      kNoProcessHandlers = 0,
+      kHandleAllocationFailure = 1 << 0,   // std::set_new_handler
+      kHandleTerminate = 1 << 1,           // std::set_terminate
+   };
+
+   enum FreezeMode : uint8_t {
+      kNoFreeze = 0,
+      kFreezeAtSafepoint = 1,   // freezable threads stop at their next Safepoint()
+      kFreezeBySignal = 2,      // freezable threads are interrupted wherever they are
+   };
+
+   enum DeathEventFlags : uint32_t {
+      kDefaultEvent = 0,
+      kDryRunCapable = 1 << 0,   // invoked by Simulate(), check IsSimulating() before doing damage
+      kInheritOnFork = 1 << 1,   // also runs when a forked child dies, by default only the registering process runs it
+   };
+
    static Death& Instance();
    static void ClearExits();
    static bool WasKilled();
    static void SetupExitHandler();
+   static void SetupExitHandler(size_t emergencyReserveBytes, uint32_t processHandlers = kNoProcessHandlers);
+   static size_t EmergencyReserveUsed();
+   static bool SetupDeathArena(size_t bytes);
+   static DeathArena& Arena();
    static std::string Message();
-   static void RegisterDeathEvent(DeathCallbackType deathFunction, const DeathCallbackArg& deathArg);
+   static void RegisterDeathEvent(DeathCallbackType deathFunction, const DeathCallbackArg& deathArg,
+           uint32_t flags = kDefaultEvent);
+   static void RegisterThreadDeathEvent(DeathCallbackType deathFunction, const DeathCallbackArg& deathArg,
+           uint32_t flags = kDefaultEvent);
+   static void ClearThreadExits();
    static void EnableDefaultFatalCall();
    static void DeleteIpcFiles(const std::string& binding);
+   static void SetCrashRecordPath(const std::string& path);
+   static void LeaveBreadcrumb(const std::string& crumb);
+   static LatencyReport Timings();
+   static LatencyReport Simulate();
+   static void SyntheticFatal(const char* file, int line, const char* function, const std::string& reason);
+   static bool IsSimulating();
+   static bool SetupDeathScheduling(bool boostPriority, int reservedCpu = -1, bool pauseThreads = false);
+
+   /// true while a fatal is being handled with pauseThreads or a freeze, see @ref Safepoint
+   static bool PauseRequested() {
+      return mPauseRequested.load(std::memory_order_relaxed);
+   }
+
+   /// Call from worker loops, blocks while another thread handles a fatal
+   static void Safepoint() {
+      if (__builtin_expect(PauseRequested(), 0)) {
+         WaitWhilePaused();
+      }
+   }
+
+   static size_t PausedThreads();
+   static bool SetupDeathFreeze(FreezeMode mode, std::chrono::milliseconds acknowledgeTimeout = std::chrono::milliseconds(100),
+           int signal = 0);
 private:
    Death();
+   ~Death();
    Death(Death&) = delete;
    Death& operator=(Death&) = delete;
    static void Received(g3::FatalMessagePtr death);
-   
+   void CaptureFatal(const g3::FatalMessage& fatal);
+   void WriteCrashRecord();
+   static void AllocationFailed();
+   static void Terminated();
+   static void WaitWhilePaused();
+   static void FreezeSignalReceived(int signal);
+   void FreezeThreads();
+   void MarkStage(uint16_t stage, uint16_t index = 0);
+
+   struct DeathEvent {
+      DeathCallbackType function;
+      DeathCallbackArg argument;
+      uint32_t flags;
+      pid_t owner;
+   };
+
+   bool IsOwned(const DeathEvent& event) const;
+   static void PrepareFork();
+   static void ParentAfterFork();
+   static void ChildAfterFork();
+
+   struct FatalDetails {
+      uint32_t signal;
+      std::string level;
+      std::string file;
+      uint32_t line;
+      std::string function;
+      std::string thread;
+      std::string message;
+   };
+
    bool mReceived;
    std::string mMessage;
    std::mutex mListLock;
-   std::vector<std::pair<DeathCallbackType, DeathCallbackArg> > mShutdownFunctions;
+   std::vector<DeathEvent> mShutdownFunctions;
+   static thread_local std::vector<DeathEvent> mThreadEvents;
+   pid_t mPid;
+   size_t mOwnedCount;
+   size_t mInheritableCount;
    bool mEnableDefaultFatal;
+   std::string mCrashRecordPath;
+   Breadcrumbs mBreadcrumbs;
+   FatalDetails mFatal;
+   std::chrono::steady_clock::time_point mEntryTime;
+   std::chrono::steady_clock::time_point mLastMark;
+   LatencyReport mTimings;
+   std::vector<uint8_t> mCallbackStatus;
+   size_t mCurrentCallback;
+   std::array<void*, 64> mStackFrames;
+   int mStackDepth;
+   EmergencyReserve mEmergencyReserve;
+   size_t mEmergencyReserveBytes;
+   DeathArena mArena;
+   bool mBoostPriority;
+   int mReservedCpu;
+   bool mPauseThreads;
+   FreezeMode mFreezeMode;
+   std::chrono::milliseconds mFreezeTimeout;
+   int mFreezeSignal;
+   uint32_t mFreezeExpected;
+   uint32_t mFreezeAcknowledged;
+   std::chrono::nanoseconds mFreezeWait;
+   static std::atomic<bool> mPauseRequested;
+   static std::atomic<size_t> mPausedThreads;
+   std::atomic<bool> mExceptionClaimed;
+   std::atomic<const char*> mExceptionType;
+   char mExceptionWhat[256];
+   std::vector<ThreadContext::Record> mThreadContexts;
+   pid_t mFaultingTid;
+   size_t mClosedSockets;
+   bool mSpilled;
+   bool mSpilling;
 };
 
 /** Makes sure that any Death tests will be cleaned up at test exit
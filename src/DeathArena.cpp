@@ -0,0 +1,89 @@
+
+#include "DeathArena.h"
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <sys/mman.h>
+
+DeathArena::DeathArena() : mBase(nullptr), mCapacity(0), mOffset(0) {
+}
+
+DeathArena::~DeathArena() {
+   Unmap();
+}
+
+/**
+ * Map and pre-fault @param bytes, replacing any earlier mapping.
+ * Not safe while callbacks may be allocating
+ */
+bool DeathArena::Map(size_t bytes) {
+   Unmap();
+   if (bytes == 0) {
+      return true;
+   }
+   void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+   if (memory == MAP_FAILED) {
+      return false;
+   }
+   mBase = static_cast<char*>(memory);
+   mCapacity = bytes;
+   mOffset.store(0);
+   return true;
+}
+
+void DeathArena::Unmap() {
+   if (mBase != nullptr) {
+      munmap(mBase, mCapacity);
+   }
+   mBase = nullptr;
+   mCapacity = 0;
+   mOffset.store(0);
+}
+
+/// @param alignment must be a power of two
+void* DeathArena::Allocate(size_t bytes, size_t alignment) {
+   if (mBase == nullptr) {
+      return nullptr;
+   }
+   const uintptr_t base = reinterpret_cast<uintptr_t>(mBase);
+   size_t offset = mOffset.load(std::memory_order_relaxed);
+   size_t aligned = 0;
+   do {
+      aligned = ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+      if (aligned + bytes > mCapacity || aligned + bytes < aligned) {
+         return nullptr;
+      }
+   } while (!mOffset.compare_exchange_weak(offset, aligned + bytes, std::memory_order_relaxed));
+   return mBase + aligned;
+}
+
+/**
+ * printf into the arena
+ * @return the formatted string or nullptr if it does not fit
+ */
+char* DeathArena::Format(const char* format, ...) {
+   va_list arguments;
+   va_start(arguments, format);
+   va_list measure;
+   va_copy(measure, arguments);
+   const int length = vsnprintf(nullptr, 0, format, measure);
+   va_end(measure);
+   char* text = length < 0 ? nullptr : static_cast<char*>(Allocate(length + 1, 1));
+   if (text != nullptr) {
+      vsnprintf(text, length + 1, format, arguments);
+   }
+   va_end(arguments);
+   return text;
+}
+
+void DeathArena::Reset() {
+   mOffset.store(0);
+}
+
+size_t DeathArena::Capacity() const {
+   return mCapacity;
+}
+
+size_t DeathArena::Used() const {
+   return mOffset.load(std::memory_order_relaxed);
+}
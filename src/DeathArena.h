@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define DEATHKNELL_HAS_PMR 1
+#endif
+#endif
+
+/**
+ * Bump allocator for death callbacks, reached through @ref Death::Arena.
+ *
+ * The memory is mmap'd and pre-faulted by @ref Death::SetupDeathArena, so an
+ * allocation at death is an atomic pointer bump that never touches the global
+ * heap. Nothing is freed individually, the arena is reset by Death::ClearExits.
+ * Allocation returns nullptr when the arena is exhausted or not mapped.
+ */
+class DeathArena {
+public:
+   DeathArena();
+   ~DeathArena();
+   bool Map(size_t bytes);
+   void Unmap();
+   void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+   char* Format(const char* format, ...) __attribute__((format(printf, 2, 3)));
+   void Reset();
+   size_t Capacity() const;
+   size_t Used() const;
+
+private:
+   DeathArena(const DeathArena&) = delete;
+   DeathArena& operator=(const DeathArena&) = delete;
+
+   char* mBase;
+   size_t mCapacity;
+   std::atomic<size_t> mOffset;
+};
+
+/**
+ * Standard allocator over a DeathArena, e.g. for a std::vector built at death.
+ * Throws std::bad_alloc when the arena is exhausted
+ */
+template<typename T>
+class DeathArenaAllocator {
+public:
+   using value_type = T;
+
+   explicit DeathArenaAllocator(DeathArena& arena) : mArena(&arena) {}
+   template<typename U>
+   DeathArenaAllocator(const DeathArenaAllocator<U>& other) : mArena(other.mArena) {}
+
+   T* allocate(size_t count) {
+      void* memory = mArena->Allocate(count * sizeof(T), alignof(T));
+      if (memory == nullptr) {
+         throw std::bad_alloc();
+      }
+      return static_cast<T*>(memory);
+   }
+
+   void deallocate(T*, size_t) {}
+
+   template<typename U>
+   bool operator==(const DeathArenaAllocator<U>& other) const { return mArena == other.mArena; }
+   template<typename U>
+   bool operator!=(const DeathArenaAllocator<U>& other) const { return mArena != other.mArena; }
+
+   DeathArena* mArena;
+};
+
+#ifdef DEATHKNELL_HAS_PMR
+/// std::pmr adapter, only when the including code is built as C++17 or later
+class DeathArenaResource : public std::pmr::memory_resource {
+public:
+   explicit DeathArenaResource(DeathArena& arena) : mArena(arena) {}
+
+private:
+   void* do_allocate(size_t bytes, size_t alignment) override {
+      void* memory = mArena.Allocate(bytes, alignment);
+      if (memory == nullptr) {
+         throw std::bad_alloc();
+      }
+      return memory;
+   }
+
+   void do_deallocate(void*, size_t, size_t) override {}
+
+   bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+      return this == &other;
+   }
+
+   DeathArena& mArena;
+};
+#endif
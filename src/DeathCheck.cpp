@@ -0,0 +1,92 @@
+
+#include "DeathCheck.h"
+#include "Death.h"
+#include <cstdarg>
+#include <cstdio>
+
+namespace {
+   std::atomic<SampledCheckSite*> gSampledSites{nullptr};
+   std::atomic<uint32_t> gGlobalPeriod{0};
+
+   // re-check a disabled site this often so it can be enabled again
+   const uint32_t kDisabledRecheck = 1 << 16;
+
+   bool EndsWith(const std::string& text, const std::string& suffix) {
+      return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+   }
+}
+
+void DeathCheck::Failed(const DeathCheckSite& site, const char* function) {
+   Raise(site, function, "");
+}
+
+void DeathCheck::FailedFormat(const DeathCheckSite& site, const char* function, const char* format, ...) {
+   char details[512];
+   va_list arguments;
+   va_start(arguments, format);
+   vsnprintf(details, sizeof(details), format, arguments);
+   va_end(arguments);
+   Raise(site, function, details);
+}
+
+void DeathCheck::Raise(const DeathCheckSite& site, const char* function, const std::string& details) {
+   std::string reason = "CONTRACT: DK_CHECK(";
+   reason.append(site.expression).append(") failed");
+   if (!details.empty()) {
+      reason.append(" ").append(details);
+   }
+   Death::SyntheticFatal(site.file, site.line, function, reason);
+}
+
+/**
+ * Called when a thread's countdown for @param site ran out
+ * @param countdown is reloaded from the current period
+ * @return true if the expression should be evaluated now
+ */
+bool SampledCheck::Due(SampledCheckSite& site, uint32_t& countdown) {
+   if (!site.registered.exchange(true)) {
+      SampledCheckSite* head = gSampledSites.load();
+      do {
+         site.next.store(head, std::memory_order_relaxed);
+      } while (!gSampledSites.compare_exchange_weak(head, &site));
+   }
+
+   const uint32_t globalPeriod = gGlobalPeriod.load(std::memory_order_relaxed);
+   const uint32_t period = globalPeriod ? globalPeriod : site.period.load(std::memory_order_relaxed);
+   if (period == 0) {
+      countdown = kDisabledRecheck;
+      return false;
+   }
+   countdown = period - 1;
+   site.evaluations.fetch_add(1, std::memory_order_relaxed);
+   return true;
+}
+
+/**
+ * Change the period of registered sites, @param line 0 matches every line in the file
+ * @return number of sites changed
+ */
+size_t SampledCheck::SetPeriod(const std::string& fileSuffix, int line, uint32_t period) {
+   size_t changed = 0;
+   for (auto site = gSampledSites.load(); site != nullptr; site = site->next.load()) {
+      if ((line == 0 || site->site.line == line) && EndsWith(site->site.file, fileSuffix)) {
+         site->period.store(period);
+         ++changed;
+      }
+   }
+   return changed;
+}
+
+/// Override the period of every sampled site, 0 goes back to the per site periods
+void SampledCheck::SetGlobalPeriod(uint32_t period) {
+   gGlobalPeriod.store(period);
+}
+
+std::vector<SampledCheck::SiteSnapshot> SampledCheck::Snapshot() {
+   std::vector<SiteSnapshot> sites;
+   for (auto site = gSampledSites.load(); site != nullptr; site = site->next.load()) {
+      sites.push_back({site->site.file, site->site.line, site->site.expression,
+         site->period.load(), site->evaluations.load()});
+   }
+   return sites;
+}
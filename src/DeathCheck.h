@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Hot path contract checks that route failures to @ref Death.
+ *
+ * Unlike the g3log CHECK the passing path is a compare and a not-taken branch:
+ * file, line and expression text are a static constant per site and all
+ * formatting happens in noinline, cold functions.
+ *
+ *    DK_CHECK(index < size);
+ *    DK_CHECK_MSG(fd >= 0, "open of %s failed with %d", path, errno);
+ *    DK_CHECK_EQ(expected, actual);    // also _NE, _LT, _LE, _GT, _GE
+ *    DK_CHECK_SAMPLED(1000, IsHeapOrdered(queue));   // evaluated 1 in 1000 passes
+ */
+#define DK_LIKELY(x) __builtin_expect(!!(x), 1)
+#define DK_UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+struct DeathCheckSite {
+   const char* file;
+   int line;
+   const char* expression;
+};
+
+/**
+ * Site of a DK_CHECK_SAMPLED. Registers itself with @ref SampledCheck the
+ * first time its expression is due, after that the period can be changed at runtime
+ */
+struct SampledCheckSite {
+   constexpr SampledCheckSite(const char* file, int line, const char* expression, uint32_t defaultPeriod)
+      : site{file, line, expression}, period(defaultPeriod), evaluations(0), next(nullptr), registered(false) {}
+
+   const DeathCheckSite site;
+   std::atomic<uint32_t> period;   // evaluate 1 in period passes, 0 never evaluates
+   std::atomic<uint64_t> evaluations;
+   std::atomic<SampledCheckSite*> next;
+   std::atomic<bool> registered;
+};
+
+class SampledCheck {
+public:
+   struct SiteSnapshot {
+      std::string file;
+      int line;
+      std::string expression;
+      uint32_t period;
+      uint64_t evaluations;
+   };
+
+   static bool Due(SampledCheckSite& site, uint32_t& countdown) __attribute__((noinline));
+   static size_t SetPeriod(const std::string& fileSuffix, int line, uint32_t period);
+   static void SetGlobalPeriod(uint32_t period);
+   static std::vector<SiteSnapshot> Snapshot();
+};
+
+class DeathCheck {
+public:
+   static void Failed(const DeathCheckSite& site, const char* function)
+      __attribute__((noinline, cold));
+   static void FailedFormat(const DeathCheckSite& site, const char* function, const char* format, ...)
+      __attribute__((noinline, cold, format(printf, 3, 4)));
+
+   template<typename Left, typename Right>
+   static void OpFailed(const DeathCheckSite& site, const char* function, const Left& left, const Right& right)
+      __attribute__((noinline, cold));
+
+private:
+   static void Raise(const DeathCheckSite& site, const char* function, const std::string& details);
+};
+
+template<typename Left, typename Right>
+void DeathCheck::OpFailed(const DeathCheckSite& site, const char* function, const Left& left, const Right& right) {
+   std::ostringstream values;
+   values << "(" << left << " vs. " << right << ")";
+   Raise(site, function, values.str());
+}
+
+#define DK_CHECK_SITE_(expressionText) \
+   static constexpr DeathCheckSite dkCheckSite{__FILE__, __LINE__, expressionText}
+
+#define DK_CHECK(expression) \
+   do { \
+      if (DK_UNLIKELY(!(expression))) { \
+         DK_CHECK_SITE_(#expression); \
+         DeathCheck::Failed(dkCheckSite, __func__); \
+      } \
+   } while (0)
+
+#define DK_CHECK_MSG(expression, ...) \
+   do { \
+      if (DK_UNLIKELY(!(expression))) { \
+         DK_CHECK_SITE_(#expression); \
+         DeathCheck::FailedFormat(dkCheckSite, __func__, __VA_ARGS__); \
+      } \
+   } while (0)
+
+#define DK_CHECK_OP_(op, left, right) \
+   do { \
+      const auto& dkLeft = (left); \
+      const auto& dkRight = (right); \
+      if (DK_UNLIKELY(!(dkLeft op dkRight))) { \
+         DK_CHECK_SITE_(#left " " #op " " #right); \
+         DeathCheck::OpFailed(dkCheckSite, __func__, dkLeft, dkRight); \
+      } \
+   } while (0)
+
+#define DK_CHECK_EQ(left, right) DK_CHECK_OP_(==, left, right)
+#define DK_CHECK_NE(left, right) DK_CHECK_OP_(!=, left, right)
+#define DK_CHECK_LT(left, right) DK_CHECK_OP_(<, left, right)
+#define DK_CHECK_LE(left, right) DK_CHECK_OP_(<=, left, right)
+#define DK_CHECK_GT(left, right) DK_CHECK_OP_(>, left, right)
+#define DK_CHECK_GE(left, right) DK_CHECK_OP_(>=, left, right)
+
+/**
+ * Evaluate @param expression only once every @param rate passes per thread.
+ * Each thread counts down on its own so the pass path has no shared writes.
+ * A period changed at runtime is picked up when the current countdown ends.
+ */
+#define DK_CHECK_SAMPLED(rate, expression) \
+   do { \
+      static SampledCheckSite dkSampledSite{__FILE__, __LINE__, #expression, (rate)}; \
+      static thread_local uint32_t dkCountdown = 0; \
+      if (DK_UNLIKELY(dkCountdown-- == 0) && SampledCheck::Due(dkSampledSite, dkCountdown) && \
+              DK_UNLIKELY(!(expression))) { \
+         DeathCheck::Failed(dkSampledSite.site, __func__); \
+      } \
+   } while (0)
@@ -0,0 +1,151 @@
+
+#include "DeathMetrics.h"
+#include <fcntl.h>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const uint32_t DeathMetricsBlock::kMagic;
+const uint32_t DeathMetricsBlock::kVersion;
+
+namespace {
+   DeathMetricsBlock gLocalBlock;
+   std::atomic<DeathMetricsBlock*> gBlock{&gLocalBlock};
+   std::mutex gPublishLock;
+   std::string gPublishedName;
+
+   std::string SegmentName(const std::string& name) {
+      return (!name.empty() && name[0] == '/') ? name : "/" + name;
+   }
+
+   void CopyValues(const DeathMetricsBlock& from, DeathMetricsBlock& to) {
+      to.registeredHooks.store(from.registeredHooks.load());
+      to.registrations.store(from.registrations.load());
+      to.clearExits.store(from.clearExits.load());
+      to.deaths.store(from.deaths.load());
+      to.lastDeathNs.store(from.lastDeathNs.load());
+      to.simulations.store(from.simulations.load());
+      to.lastSimulationNs.store(from.lastSimulationNs.load());
+      to.maxSimulationNs.store(from.maxSimulationNs.load());
+   }
+}
+
+/// The block currently being updated, a relaxed pointer load
+DeathMetricsBlock& DeathMetrics::Block() {
+   return *gBlock.load(std::memory_order_relaxed);
+}
+
+/**
+ * For a forked child: stop updating the block its parent published and start
+ * from zero in process memory. The parent's segment is neither unmapped nor
+ * unlinked, and no lock is taken since another thread may have held it at fork
+ */
+void DeathMetrics::UseProcessLocalBlock() {
+   DeathMetricsBlock zero{};
+   CopyValues(zero, gLocalBlock);
+   gLocalBlock.pid = getpid();
+   gBlock.store(&gLocalBlock, std::memory_order_relaxed);
+   gPublishedName.clear();
+}
+
+/**
+ * Move the metrics into the shared memory segment @param name (shm_open naming),
+ * current values are carried over
+ * @return false if the segment could not be created
+ */
+bool DeathMetrics::Publish(const std::string& name) {
+   std::lock_guard<std::mutex> glock(gPublishLock);
+   const std::string segment = SegmentName(name);
+   int fd = shm_open(segment.c_str(), O_CREAT | O_RDWR, 0644);
+   if (fd < 0) {
+      return false;
+   }
+   if (ftruncate(fd, sizeof(DeathMetricsBlock)) != 0) {
+      close(fd);
+      return false;
+   }
+   void* memory = mmap(nullptr, sizeof(DeathMetricsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (memory == MAP_FAILED) {
+      return false;
+   }
+
+   auto shared = new (memory) DeathMetricsBlock;
+   shared->version = DeathMetricsBlock::kVersion;
+   shared->pid = static_cast<uint32_t>(getpid());
+   shared->size = sizeof(DeathMetricsBlock);
+   CopyValues(Block(), *shared);
+   std::atomic_thread_fence(std::memory_order_release);
+   shared->magic = DeathMetricsBlock::kMagic;
+   gBlock.store(shared);
+
+   if (!gPublishedName.empty() && gPublishedName != segment) {
+      shm_unlink(gPublishedName.c_str());
+   }
+   gPublishedName = segment;
+   return true;
+}
+
+/**
+ * Go back to the process local block and remove the segment. The old mapping
+ * is left in place since an update may still be in flight on it
+ */
+void DeathMetrics::Unpublish() {
+   std::lock_guard<std::mutex> glock(gPublishLock);
+   if (gPublishedName.empty()) {
+      return;
+   }
+   CopyValues(Block(), gLocalBlock);
+   gBlock.store(&gLocalBlock);
+   shm_unlink(gPublishedName.c_str());
+   gPublishedName.clear();
+}
+
+std::string DeathMetrics::PublishedName() {
+   std::lock_guard<std::mutex> glock(gPublishLock);
+   return gPublishedName;
+}
+
+/**
+ * For monitors: map a published block read-only
+ * @return nullptr if the segment does not exist or is not a compatible block
+ */
+const DeathMetricsBlock* DeathMetrics::Attach(const std::string& name) {
+   int fd = shm_open(SegmentName(name).c_str(), O_RDONLY, 0);
+   if (fd < 0) {
+      return nullptr;
+   }
+   struct stat status;
+   if (fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(DeathMetricsBlock))) {
+      close(fd);
+      return nullptr;
+   }
+   void* memory = mmap(nullptr, sizeof(DeathMetricsBlock), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (memory == MAP_FAILED) {
+      return nullptr;
+   }
+   auto block = static_cast<const DeathMetricsBlock*>(memory);
+   if (block->magic != DeathMetricsBlock::kMagic || block->version < DeathMetricsBlock::kVersion) {
+      munmap(memory, sizeof(DeathMetricsBlock));
+      return nullptr;
+   }
+   return block;
+}
+
+void DeathMetrics::Detach(const DeathMetricsBlock* block) {
+   if (block != nullptr) {
+      munmap(const_cast<DeathMetricsBlock*>(block), sizeof(DeathMetricsBlock));
+   }
+}
+
+void DeathMetrics::RecordSimulation(uint64_t nanoseconds) {
+   auto& block = Block();
+   block.simulations.fetch_add(1, std::memory_order_relaxed);
+   block.lastSimulationNs.store(nanoseconds, std::memory_order_relaxed);
+   uint64_t maximum = block.maxSimulationNs.load(std::memory_order_relaxed);
+   while (nanoseconds > maximum && !block.maxSimulationNs.compare_exchange_weak(maximum, nanoseconds)) {
+   }
+}
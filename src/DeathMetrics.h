@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Fixed layout counters and gauges maintained by @ref Death.
+ *
+ * By default the block lives in process memory. @ref DeathMetrics::Publish
+ * moves it into a named POSIX shared memory segment so that an external
+ * monitor can map it read-only and poll it without any syscalls in the
+ * target process. Layout changes bump kVersion, fields are only appended.
+ */
+struct DeathMetricsBlock {
+   static const uint32_t kMagic = 0x4D4B4444; // "DDKM"
+   static const uint32_t kVersion = 1;
+
+   uint32_t magic;
+   uint32_t version;
+   uint32_t pid;
+   uint32_t size;
+   alignas(64) std::atomic<uint64_t> registeredHooks;   // gauge
+   std::atomic<uint64_t> registrations;                 // counter, registration rate = delta over time
+   std::atomic<uint64_t> clearExits;
+   std::atomic<uint64_t> deaths;
+   std::atomic<uint64_t> lastDeathNs;                   // handler entry to record written
+   std::atomic<uint64_t> simulations;
+   std::atomic<uint64_t> lastSimulationNs;
+   std::atomic<uint64_t> maxSimulationNs;
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "DeathMetricsBlock must be readable from another process");
+
+class DeathMetrics {
+public:
+   static DeathMetricsBlock& Block();
+   static bool Publish(const std::string& name);
+   static void Unpublish();
+   static std::string PublishedName();
+   static void UseProcessLocalBlock();
+
+   static const DeathMetricsBlock* Attach(const std::string& name);
+   static void Detach(const DeathMetricsBlock* block);
+
+   static void RecordSimulation(uint64_t nanoseconds);
+};
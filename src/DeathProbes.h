@@ -0,0 +1,38 @@
+#pragma once
+
+/**
+ * USDT static tracepoints, provider "deathknell". Each probe is a single nop
+ * until a tracer attaches, e.g.
+ *
+ *    bpftrace -e 'usdt:/usr/local/probe/lib/libDeathKnell.so:deathknell:callback_enter
+ *                 { @start[tid] = nsecs; }
+ *                 usdt:/usr/local/probe/lib/libDeathKnell.so:deathknell:callback_return
+ *                 { @ns[usym(arg0)] = hist(nsecs - @start[tid]); }'
+ *
+ *    register_event   (callback address, const char* argument)
+ *    clear_exits      (number of registered callbacks cleared)
+ *    received_enter   (signal id)
+ *    received_exit    (signal id)   right before the fatal is handed to the logger
+ *    callback_enter   (callback address, const char* argument, int thread hook)
+ *    callback_return  (callback address, const char* argument, int thread hook)
+ *                     thread hook is 1 for the faulting thread's own hooks, which run first
+ *
+ * Compiled out when <sys/sdt.h> (systemtap-sdt-devel) is not available or
+ * DEATHKNELL_NO_USDT is defined.
+ */
+#if !defined(DEATHKNELL_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define DEATHKNELL_HAS_USDT 1
+#endif
+#endif
+
+#ifdef DEATHKNELL_HAS_USDT
+#include <sys/sdt.h>
+#define DK_PROBE1(name, arg1) DTRACE_PROBE1(deathknell, name, arg1)
+#define DK_PROBE2(name, arg1, arg2) DTRACE_PROBE2(deathknell, name, arg1, arg2)
+#define DK_PROBE3(name, arg1, arg2, arg3) DTRACE_PROBE3(deathknell, name, arg1, arg2, arg3)
+#else
+#define DK_PROBE1(name, arg1) do {} while (0)
+#define DK_PROBE2(name, arg1, arg2) do {} while (0)
+#define DK_PROBE3(name, arg1, arg2, arg3) do {} while (0)
+#endif
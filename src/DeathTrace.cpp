@@ -0,0 +1,144 @@
+
+#include "DeathTrace.h"
+#include "CrashRecord.h"
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+   struct TraceEvent {
+      uint64_t startNs;
+      uint64_t durationNs;
+      uint64_t address;
+      uint32_t tid;
+      uint16_t stage;
+      uint16_t index;
+      uint8_t category;
+      std::atomic<bool> published;
+   };
+
+   std::mutex gTraceLock;
+   std::unique_ptr<TraceEvent[]> gEvents;
+   std::atomic<bool> gEnabled{false};
+   std::atomic<size_t> gNext{0};
+   std::atomic<size_t> gDropped{0};
+   size_t gCapacity = 0;
+   std::string gPath;
+
+   bool WriteAll(int fd, const char* data, size_t length) {
+      while (length > 0) {
+         ssize_t written = write(fd, data, length);
+         if (written <= 0) {
+            return false;
+         }
+         data += written;
+         length -= written;
+      }
+      return true;
+   }
+
+   bool WriteAll(int fd, const char* text) {
+      return WriteAll(fd, text, strlen(text));
+   }
+}
+
+/**
+ * Start recording, @param capacity events are allocated up front. Call during
+ * setup, not while a death or simulation may be recording
+ */
+void DeathTrace::Enable(const std::string& path, size_t capacity) {
+   std::lock_guard<std::mutex> glock(gTraceLock);
+   gEnabled.store(false);
+   gEvents.reset(new TraceEvent[capacity]);
+   for (size_t i = 0; i < capacity; ++i) {
+      gEvents[i].published.store(false);
+   }
+   gCapacity = capacity;
+   gPath = path;
+   gNext.store(0);
+   gDropped.store(0);
+   gEnabled.store(true);
+}
+
+void DeathTrace::Disable() {
+   std::lock_guard<std::mutex> glock(gTraceLock);
+   gEnabled.store(false);
+}
+
+bool DeathTrace::IsEnabled() {
+   return gEnabled.load(std::memory_order_relaxed);
+}
+
+/// Timestamps are steady clock nanoseconds. Events beyond the capacity are dropped
+void DeathTrace::Record(Category category, uint16_t stage, uint16_t index, uint64_t address,
+        uint64_t startNs, uint64_t durationNs) {
+   if (!gEnabled.load(std::memory_order_acquire)) {
+      return;
+   }
+   const size_t slot = gNext.fetch_add(1, std::memory_order_relaxed);
+   if (slot >= gCapacity) {
+      gDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+   }
+   TraceEvent& event = gEvents[slot];
+   event.startNs = startNs;
+   event.durationNs = durationNs;
+   event.address = address;
+   event.tid = static_cast<uint32_t>(syscall(SYS_gettid));
+   event.stage = stage;
+   event.index = index;
+   event.category = category;
+   event.published.store(true, std::memory_order_release);
+}
+
+/**
+ * Write the recorded events as Chrome trace JSON and start over with an empty buffer.
+ * Formats into a stack buffer and uses write(2), no allocation per event
+ * @return false if tracing is disabled or the file could not be written
+ */
+bool DeathTrace::Flush() {
+   std::lock_guard<std::mutex> glock(gTraceLock);
+   if (!gEnabled.load()) {
+      return false;
+   }
+   int fd = open(gPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0) {
+      return false;
+   }
+   static const char* kCategory[] = {"death", "simulation"};
+   const int pid = getpid();
+   const size_t count = std::min(gNext.load(), gCapacity);
+   bool success = WriteAll(fd, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+   bool first = true;
+   char line[512];
+   for (size_t i = 0; i < count && success; ++i) {
+      TraceEvent& event = gEvents[i];
+      if (!event.published.load(std::memory_order_acquire)) {
+         continue;
+      }
+      const int length = snprintf(line, sizeof(line),
+              "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,"
+              "\"pid\":%d,\"tid\":%u,\"args\":{\"index\":%u,\"address\":\"0x%llx\"}}",
+              first ? "" : ",\n", CrashRecord::StageName(event.stage).c_str(),
+              kCategory[event.category > kSimulation ? static_cast<uint8_t>(kDeath) : event.category],
+              static_cast<unsigned long long>(event.startNs / 1000), static_cast<unsigned long long>(event.startNs % 1000),
+              static_cast<unsigned long long>(event.durationNs / 1000), static_cast<unsigned long long>(event.durationNs % 1000),
+              pid, event.tid, event.index, static_cast<unsigned long long>(event.address));
+      success = length > 0 && WriteAll(fd, line, std::min(static_cast<size_t>(length), sizeof(line) - 1));
+      event.published.store(false, std::memory_order_relaxed);
+      first = false;
+   }
+   success = success && WriteAll(fd, "\n]}\n");
+   close(fd);
+   gNext.store(0);
+   return success;
+}
+
+size_t DeathTrace::Dropped() {
+   return gDropped.load();
+}
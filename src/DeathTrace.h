@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Optional timeline of the death sequence in Chrome trace event format.
+ *
+ * Every stage that @ref Death::Received or @ref Death::Simulate times (see
+ * CrashRecord::TimingStage) is also stored as a complete event in a buffer that
+ * is allocated by @ref Enable, so recording at death is a slot claim and a few
+ * stores. The file is written when the fatal is handed to the logger, or on
+ * @ref Flush, and opens directly in chrome://tracing, Perfetto UI or Speedscope.
+ */
+class DeathTrace {
+public:
+   enum Category : uint8_t {
+      kDeath = 0,
+      kSimulation = 1,
+   };
+
+   static void Enable(const std::string& path, size_t capacity = 4096);
+   static void Disable();
+   static bool IsEnabled();
+   static void Record(Category category, uint16_t stage, uint16_t index, uint64_t address,
+           uint64_t startNs, uint64_t durationNs);
+   static bool Flush();
+   static size_t Dropped();
+};
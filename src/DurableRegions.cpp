@@ -0,0 +1,258 @@
+
+#include "DurableRegions.h"
+#include "CrashRecord.h"
+#include "DeathTrace.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <sys/mman.h>
+#include <unistd.h>
+
+const size_t DurableRegions::kMaxRegions;
+const size_t DurableRegions::kNameSize;
+
+namespace {
+   enum SlotState : int { kFree = 0, kClaimed, kReady };
+
+   struct Region {
+      std::atomic<int> state;
+      DurableRegions::Kind kind;
+      void* address;
+      size_t length;
+      int fd;
+      char name[DurableRegions::kNameSize];
+      std::atomic<uint8_t> status;
+      std::atomic<int> error;
+      std::atomic<uint64_t> durationNs;
+   };
+
+   Region gRegions[DurableRegions::kMaxRegions];
+
+   /// One flush round, started by Begin
+   std::atomic<size_t> gNext{DurableRegions::kMaxRegions};
+   std::atomic<size_t> gExpected{0};
+   std::atomic<size_t> gCompleted{0};
+   std::atomic<int64_t> gDeadlineMs{1000};
+   /// steady clock nanoseconds, set by Begin
+   std::atomic<int64_t> gDeadlineNs{0};
+
+   bool PastDeadline() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now().time_since_epoch()).count() >= gDeadlineNs.load();
+   }
+
+   std::mutex gWorkerLock;
+   std::condition_variable gWorkerWake;
+   std::vector<std::thread> gWorkers;
+   uint64_t gRound = 0;
+   bool gStopWorkers = false;
+
+   int Claim(DurableRegions::Kind kind, void* address, size_t length, int fd, const char* name) {
+      for (size_t id = 0; id < DurableRegions::kMaxRegions; ++id) {
+         int expected = kFree;
+         if (gRegions[id].state.compare_exchange_strong(expected, kClaimed)) {
+            Region& region = gRegions[id];
+            region.kind = kind;
+            region.address = address;
+            region.length = length;
+            region.fd = fd;
+            const size_t nameLength = strnlen(name, DurableRegions::kNameSize - 1);
+            memcpy(region.name, name, nameLength);
+            region.name[nameLength] = '\0';
+            region.status.store(DurableRegions::kPending);
+            region.error.store(0);
+            region.durationNs.store(0);
+            region.state.store(kReady, std::memory_order_release);
+            return static_cast<int>(id);
+         }
+      }
+      return -1;
+   }
+
+   /**
+    * Take regions off the shared cursor until none are left or the deadline
+    * has passed, each flush is a trace event on the flushing thread
+    */
+   void FlushRegions() {
+      while (!PastDeadline()) {
+         const size_t id = gNext.fetch_add(1);
+         if (id >= DurableRegions::kMaxRegions) {
+            break;
+         }
+         Region& region = gRegions[id];
+         if (region.state.load(std::memory_order_acquire) != kReady) {
+            continue;
+         }
+         if (region.status.load() != DurableRegions::kPending) {
+            continue;
+         }
+         region.status.store(DurableRegions::kFlushing);
+         const auto start = std::chrono::steady_clock::now();
+         const int result = (region.kind == DurableRegions::kMapping)
+                 ? msync(region.address, region.length, MS_SYNC)
+                 : fdatasync(region.fd);
+         region.error.store(result == 0 ? 0 : errno);
+         const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now() - start);
+         region.durationNs.store(duration.count());
+         region.status.store(result == 0 ? DurableRegions::kDone : DurableRegions::kFailed);
+         gCompleted.fetch_add(1);
+         if (DeathTrace::IsEnabled()) {
+            DeathTrace::Record(DeathTrace::kDeath, CrashRecord::StageDurableFlush, static_cast<uint16_t>(id),
+                    reinterpret_cast<uint64_t>(region.address),
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count(),
+                    duration.count());
+         }
+      }
+   }
+
+   void Worker() {
+      uint64_t seen = 0;
+      std::unique_lock<std::mutex> lock(gWorkerLock);
+      while (true) {
+         gWorkerWake.wait(lock, [&] { return gStopWorkers || gRound != seen; });
+         if (gStopWorkers) {
+            return;
+         }
+         seen = gRound;
+         lock.unlock();
+         FlushRegions();
+         lock.lock();
+      }
+   }
+}
+
+/**
+ * @param address page aligned, as returned by mmap
+ * @param name copied, reported in the crash record
+ * @return id for @ref Unregister, -1 when the table is full
+ */
+int DurableRegions::RegisterMapping(void* address, size_t length, const char* name) {
+   return Claim(kMapping, address, length, -1, name);
+}
+
+/// @param fd stays owned by the caller, unregister it before closing
+int DurableRegions::RegisterFile(int fd, const char* name) {
+   return Claim(kFile, nullptr, 0, fd, name);
+}
+
+void DurableRegions::Unregister(int id) {
+   if (id >= 0 && static_cast<size_t>(id) < kMaxRegions) {
+      gRegions[id].state.store(kFree, std::memory_order_release);
+   }
+}
+
+void DurableRegions::Clear() {
+   for (auto& region : gRegions) {
+      region.state.store(kFree, std::memory_order_release);
+   }
+}
+
+/**
+ * Create @param workers flush threads, at death they are woken instead of created
+ * @return false if workers are already running
+ */
+bool DurableRegions::Start(size_t workers) {
+   std::lock_guard<std::mutex> glock(gWorkerLock);
+   if (!gWorkers.empty()) {
+      return false;
+   }
+   gStopWorkers = false;
+   for (size_t index = 0; index < workers; ++index) {
+      gWorkers.emplace_back(&Worker);
+   }
+   return true;
+}
+
+void DurableRegions::Stop() {
+   std::vector<std::thread> workers;
+   {
+      std::lock_guard<std::mutex> glock(gWorkerLock);
+      gStopWorkers = true;
+      workers.swap(gWorkers);
+   }
+   gWorkerWake.notify_all();
+   for (auto& worker : workers) {
+      worker.join();
+   }
+}
+
+/**
+ * Child side of fork(), called by Death. The workers were not copied and one
+ * may have held the lock, the handles are dropped without a join and the lock
+ * and condition replaced so that @ref Start works in the child
+ */
+void DurableRegions::AfterFork() {
+   new (&gWorkers) std::vector<std::thread>();
+   new (&gWorkerLock) std::mutex();
+   new (&gWorkerWake) std::condition_variable();
+   gStopWorkers = false;
+}
+
+/// How long a flush round may take from @ref Begin, 1 second by default
+void DurableRegions::SetDeadline(std::chrono::milliseconds deadline) {
+   gDeadlineMs.store(deadline.count());
+}
+
+/**
+ * Reset every registered region to pending, start the deadline and wake the workers
+ * @return regions to flush
+ */
+size_t DurableRegions::Begin() {
+   gDeadlineNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count() + gDeadlineMs.load() * 1000000);
+   size_t expected = 0;
+   for (auto& region : gRegions) {
+      if (region.state.load(std::memory_order_acquire) == kReady) {
+         region.status.store(kPending);
+         ++expected;
+      }
+   }
+   gExpected.store(expected);
+   gCompleted.store(0);
+   gNext.store(0);
+   // a thread that died holding the lock only costs the parallelism, Finish flushes serially
+   if (expected > 0 && gWorkerLock.try_lock()) {
+      ++gRound;
+      gWorkerLock.unlock();
+      gWorkerWake.notify_all();
+   }
+   return expected;
+}
+
+/**
+ * Flush what the workers have not picked up yet on the calling thread, then
+ * wait for the rest. Nothing new is started once the deadline set by
+ * @ref Begin has passed, a flush already running is waited for until then
+ * @return true if every region finished, successfully or not, in time
+ */
+bool DurableRegions::Finish() {
+   FlushRegions();
+   while (gCompleted.load() < gExpected.load() && !PastDeadline()) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+   }
+   return gCompleted.load() >= gExpected.load();
+}
+
+/// Begin and Finish, for flushing outside of a death
+bool DurableRegions::Flush() {
+   Begin();
+   return Finish();
+}
+
+/// Outcome of the last flush round for every registered region, in id order
+std::vector<DurableRegions::Result> DurableRegions::Results() {
+   std::vector<Result> results;
+   for (const auto& region : gRegions) {
+      if (region.state.load(std::memory_order_acquire) != kReady) {
+         continue;
+      }
+      results.push_back({region.kind, static_cast<Status>(region.status.load()), region.error.load(),
+                         std::chrono::nanoseconds(region.durationNs.load()), region.name});
+   }
+   return results;
+}
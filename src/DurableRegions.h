@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Memory mapped ranges and file descriptors that are flushed to disk when the
+ * process dies, msync(MS_SYNC) for mappings and fdatasync for descriptors.
+ *
+ * Death::Received starts the flush before the death callbacks run, on worker
+ * threads created by @ref Start, and then helps with whatever is left. The
+ * deadline counts from that start, no region is picked up after it and the
+ * dying thread stops waiting then. The outcome of every region is written to
+ * the crash record. Without workers the dying thread flushes the regions one
+ * by one after the callbacks.
+ *
+ * Registration uses a fixed table of kMaxRegions slots and never locks, so a
+ * thread registering at the moment of the fatal cannot block the flush.
+ */
+class DurableRegions {
+public:
+   static const size_t kMaxRegions = 64;
+   static const size_t kNameSize = 48;
+
+   enum Kind : uint8_t { kMapping = 0, kFile = 1 };
+   enum Status : uint8_t { kPending = 0, kFlushing = 1, kDone = 2, kFailed = 3 };
+
+   struct Result {
+      Kind kind;
+      Status status;
+      int error;
+      std::chrono::nanoseconds duration;
+      std::string name;
+   };
+
+   static int RegisterMapping(void* address, size_t length, const char* name);
+   static int RegisterFile(int fd, const char* name);
+   static void Unregister(int id);
+   static void Clear();
+
+   static bool Start(size_t workers);
+   static void Stop();
+   static void AfterFork();
+   static void SetDeadline(std::chrono::milliseconds deadline);
+
+   static size_t Begin();
+   static bool Finish();
+   static bool Flush();
+   static std::vector<Result> Results();
+};
@@ -0,0 +1,83 @@
+
+#include "EarlyDeath.h"
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+const size_t EarlyDeath::kMaxEvents;
+
+namespace {
+   struct EarlyEvent {
+      std::atomic<bool> claimed;
+      std::atomic<EarlyDeath::Callback> function;
+      std::atomic<const char*> argument;
+   };
+
+   /// No constructor runs for these, zero is a valid empty registry
+   EarlyEvent gEvents[EarlyDeath::kMaxEvents];
+
+   void WriteStderr(const char* text) {
+      size_t remaining = strlen(text);
+      while (remaining > 0) {
+         const ssize_t written = write(STDERR_FILENO, text, remaining);
+         if (written <= 0) {
+            return;
+         }
+         text += written;
+         remaining -= written;
+      }
+   }
+}
+
+/**
+ * Safe before main and from any thread. The function pointer is published
+ * last, a claimed slot whose function is still null is skipped at death
+ * @return false when the registry is full
+ */
+bool EarlyDeath::Register(Callback function, const char* argument) {
+   for (size_t slot = 0; slot < kMaxEvents; ++slot) {
+      if (!gEvents[slot].claimed.exchange(true, std::memory_order_relaxed)) {
+         gEvents[slot].argument.store(argument, std::memory_order_relaxed);
+         gEvents[slot].function.store(function, std::memory_order_release);
+         return true;
+      }
+   }
+   return false;
+}
+
+/// Each hook runs at most once, taking it out of the registry before the call
+void EarlyDeath::RunEvents() {
+   for (size_t slot = 0; slot < kMaxEvents; ++slot) {
+      Callback function = gEvents[slot].function.exchange(nullptr, std::memory_order_acquire);
+      if (function != nullptr) {
+         function(gEvents[slot].argument.load(std::memory_order_relaxed));
+         gEvents[slot].claimed.store(false, std::memory_order_release);
+      }
+   }
+}
+
+/// The fallback death path, nothing here allocates or needs the logger
+void EarlyDeath::Fatal(const char* reason) {
+   WriteStderr("FATAL: ");
+   WriteStderr(reason != nullptr ? reason : "unknown");
+   WriteStderr("\n");
+   RunEvents();
+   _exit(EXIT_FAILURE);
+}
+
+size_t EarlyDeath::Registered() {
+   size_t count = 0;
+   for (size_t slot = 0; slot < kMaxEvents; ++slot) {
+      count += gEvents[slot].function.load(std::memory_order_relaxed) != nullptr;
+   }
+   return count;
+}
+
+/// For tests, not safe against concurrent Register
+void EarlyDeath::Clear() {
+   for (size_t slot = 0; slot < kMaxEvents; ++slot) {
+      gEvents[slot].function.store(nullptr, std::memory_order_relaxed);
+      gEvents[slot].argument.store(nullptr, std::memory_order_relaxed);
+      gEvents[slot].claimed.store(false, std::memory_order_relaxed);
+   }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Minimal death hooks for the parts of the process lifetime that Death cannot
+ * cover: static initialization before main, and static destruction after the
+ * Death singleton or the g3log worker is gone.
+ *
+ * All state is constant-initialized (constexpr constructors on atomics, no
+ * dynamic initializer), so registration works from any static constructor and
+ * the registry is never destroyed. Hooks take a C string and must not rely on
+ * anything with a non-trivial destructor.
+ *
+ * When Death is alive the hooks also run at the end of @ref Death::Received.
+ * Otherwise @ref Fatal writes the reason to stderr with write(2), runs the
+ * hooks and _exit's.
+ */
+class EarlyDeath {
+public:
+   typedef void (*Callback)(const char* argument);
+   static const size_t kMaxEvents = 16;
+
+   static bool Register(Callback function, const char* argument);
+   static void RunEvents();
+   [[noreturn]] static void Fatal(const char* reason);
+   static size_t Registered();
+   static void Clear();
+};
@@ -0,0 +1,94 @@
+
+#include "EmergencyReserve.h"
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+   /// Resident bytes of the process, the second field of /proc/self/statm, 0 if unknown
+   size_t ResidentBytes(int statmFd) {
+      if (statmFd < 0) {
+         return 0;
+      }
+      char buffer[128];
+      const ssize_t length = pread(statmFd, buffer, sizeof(buffer) - 1, 0);
+      if (length <= 0) {
+         return 0;
+      }
+      buffer[length] = '\0';
+      char* field = nullptr;
+      strtoull(buffer, &field, 10);
+      const unsigned long long pages = strtoull(field, nullptr, 10);
+      return static_cast<size_t>(pages) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+   }
+}
+
+EmergencyReserve::EmergencyReserve() : mRegion(nullptr), mSize(0), mHeld(false), mReleased(0),
+   mResidentBaseline(0), mStatmFd(-1) {
+}
+
+EmergencyReserve::~EmergencyReserve() {
+   Release();
+   if (mStatmFd >= 0) {
+      close(mStatmFd);
+   }
+}
+
+/// (Re)allocate the reserve rounded up to whole pages, any reserve still held is released first
+void EmergencyReserve::Reserve(size_t bytes) {
+   Release();
+   mReleased = 0;
+   if (bytes == 0) {
+      return;
+   }
+   if (mStatmFd < 0) {
+      mStatmFd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+   }
+   const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+   const size_t size = (bytes + page - 1) / page * page;
+   void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (region == MAP_FAILED) {
+      return;
+   }
+   memset(region, 0xdb, size);
+   mRegion = region;
+   mSize = size;
+   mHeld.store(true);
+}
+
+/**
+ * Unmap the reserve. Safe to call more than once, only the first call after
+ * @ref Reserve frees anything
+ * @return bytes released by this call
+ */
+size_t EmergencyReserve::Release() {
+   if (!mHeld.exchange(false)) {
+      return 0;
+   }
+   munmap(mRegion, mSize);
+   mReleased = mSize;
+   mRegion = nullptr;
+   mSize = 0;
+   mResidentBaseline = ResidentBytes(mStatmFd);
+   return mReleased;
+}
+
+size_t EmergencyReserve::Size() const {
+   return mSize;
+}
+
+size_t EmergencyReserve::Released() const {
+   return mReleased;
+}
+
+/// Resident growth since the release, capped at the released size
+size_t EmergencyReserve::Used() const {
+   if (mReleased == 0) {
+      return 0;
+   }
+   const size_t resident = ResidentBytes(mStatmFd);
+   const size_t grown = resident > mResidentBaseline ? resident - mResidentBaseline : 0;
+   return grown < mReleased ? grown : mReleased;
+}
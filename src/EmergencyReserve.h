@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Memory set aside while the process is healthy and handed back to the kernel
+ * when a fatal arrives, so death callbacks can allocate even if the fatal was
+ * caused by memory exhaustion or a cgroup limit.
+ *
+ * The reserve is a private anonymous mapping of its own, every page is touched
+ * up front so it is resident and charged, not just promised. A release unmaps
+ * it, which lowers the resident size by the full reserve no matter which malloc
+ * arena the dying thread allocates from next. How much of it the death path
+ * used is measured as resident growth from /proc/self/statm, which is opened
+ * by @ref Reserve so the death path only needs pread(2).
+ */
+class EmergencyReserve {
+public:
+   EmergencyReserve();
+   ~EmergencyReserve();
+   void Reserve(size_t bytes);
+   size_t Release();
+   size_t Size() const;
+   size_t Released() const;
+   size_t Used() const;
+
+private:
+   EmergencyReserve(const EmergencyReserve&) = delete;
+   EmergencyReserve& operator=(const EmergencyReserve&) = delete;
+
+   void* mRegion;
+   size_t mSize;
+   std::atomic<bool> mHeld;
+   size_t mReleased;
+   size_t mResidentBaseline;
+   int mStatmFd;
+};
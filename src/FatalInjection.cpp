@@ -0,0 +1,101 @@
+
+#include "FatalInjection.h"
+#include "Death.h"
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+std::atomic<bool> FatalInjection::gArmed{false};
+
+namespace {
+   struct Site {
+      std::atomic<uint64_t> threshold; // fire when a 32 bit random value is below it, 0 is off
+      std::atomic<uint32_t> maxPerSecond;
+      std::atomic<uint64_t> windowSecond;
+      std::atomic<uint32_t> windowCount;
+      std::atomic<uint64_t> fired;
+   };
+
+   Site gSites[FatalInjection::kMaxSites];
+
+   uint32_t NextRandom() {
+      thread_local uint64_t state = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+              static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+              0x9E3779B97F4A7C15ULL;
+      // xorshift64*
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      return static_cast<uint32_t>((state * 0x2545F4914F6CDD1DULL) >> 32);
+   }
+
+   /// Approximate per second limit, a few extra fires are possible when the window turns over
+   bool WithinRateLimit(Site& site) {
+      const uint32_t maxPerSecond = site.maxPerSecond.load(std::memory_order_relaxed);
+      const uint64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+              std::chrono::steady_clock::now().time_since_epoch()).count();
+      uint64_t window = site.windowSecond.load(std::memory_order_relaxed);
+      if (window != second && site.windowSecond.compare_exchange_strong(window, second)) {
+         site.windowCount.store(0, std::memory_order_relaxed);
+      }
+      return site.windowCount.fetch_add(1, std::memory_order_relaxed) < maxPerSecond;
+   }
+}
+
+/**
+ * @param probability 0.0 - 1.0 chance that an armed site fires each time it is passed
+ * @param maxPerSecond upper bound on fires per second for the site
+ */
+void FatalInjection::Configure(uint32_t siteId, double probability, uint32_t maxPerSecond) {
+   if (siteId >= kMaxSites) {
+      return;
+   }
+   probability = probability < 0.0 ? 0.0 : (probability > 1.0 ? 1.0 : probability);
+   Site& site = gSites[siteId];
+   site.maxPerSecond.store(maxPerSecond);
+   site.windowCount.store(0);
+   site.threshold.store(static_cast<uint64_t>(probability * 4294967296.0));
+}
+
+void FatalInjection::Arm() {
+   gArmed.store(true);
+}
+
+void FatalInjection::Disarm() {
+   gArmed.store(false);
+}
+
+bool FatalInjection::IsArmed() {
+   return gArmed.load(std::memory_order_relaxed);
+}
+
+uint64_t FatalInjection::Fired(uint32_t siteId) {
+   return siteId < kMaxSites ? gSites[siteId].fired.load() : 0;
+}
+
+/// Disarm and remove the configuration of every site
+void FatalInjection::Reset() {
+   Disarm();
+   for (auto& site : gSites) {
+      site.threshold.store(0);
+      site.maxPerSecond.store(0);
+      site.windowSecond.store(0);
+      site.windowCount.store(0);
+      site.fired.store(0);
+   }
+}
+
+/// Slow path, only reached while armed
+void FatalInjection::Evaluate(uint32_t siteId, const char* file, int line, const char* function) {
+   if (siteId >= kMaxSites) {
+      return;
+   }
+   Site& site = gSites[siteId];
+   const uint64_t threshold = site.threshold.load(std::memory_order_relaxed);
+   if (threshold == 0 || NextRandom() >= threshold || !WithinRateLimit(site)) {
+      return;
+   }
+   site.fired.fetch_add(1, std::memory_order_relaxed);
+   Death::SyntheticFatal(file, line, function, "Injected fatal at site " + std::to_string(siteId));
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Chaos testing: raise synthetic fatals at marked sites so the whole
+ * @ref Death cleanup pipeline is exercised under real load.
+ *
+ *    DK_INJECT_FATAL(kParserSite);   // kParserSite < FatalInjection::kMaxSites
+ *
+ * While disarmed a site costs one relaxed atomic load and a not-taken branch.
+ * Once armed each configured site fires with its probability, but at most
+ * maxPerSecond times per second.
+ */
+class FatalInjection {
+public:
+   static const uint32_t kMaxSites = 256;
+
+   static void Configure(uint32_t siteId, double probability, uint32_t maxPerSecond);
+   static void Arm();
+   static void Disarm();
+   static bool IsArmed();
+   static uint64_t Fired(uint32_t siteId);
+   static void Reset();
+
+   static void Evaluate(uint32_t siteId, const char* file, int line, const char* function)
+      __attribute__((noinline, cold));
+
+   static std::atomic<bool> gArmed;
+};
+
+#define DK_INJECT_FATAL(siteId) \
+   do { \
+      if (__builtin_expect(FatalInjection::gArmed.load(std::memory_order_relaxed), 0)) { \
+         FatalInjection::Evaluate((siteId), __FILE__, __LINE__, __func__); \
+      } \
+   } while (0)
@@ -0,0 +1,235 @@
+
+#include "MemoryGuard.h"
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+   struct ShedEvent {
+      Death::DeathCallbackType function;
+      Death::DeathCallbackArg argument;
+   };
+
+   std::mutex gGuardLock;
+   std::condition_variable gGuardWake;
+   std::thread gMonitor;
+   bool gStopMonitor = false;
+   std::vector<ShedEvent> gShedEvents;
+   std::atomic<uint64_t> gLimit{0};
+   std::atomic<int> gUsageFd{-1};
+   std::atomic<bool> gUsingCgroup{false};
+
+   const std::string kCgroupRoot = "/sys/fs/cgroup";
+
+   /// cgroup v2 directory of this process, empty on v1 or outside a cgroup
+   std::string CgroupDirectory() {
+      std::ifstream cgroups("/proc/self/cgroup");
+      std::string line;
+      while (std::getline(cgroups, line)) {
+         if (line.compare(0, 3, "0::") == 0) {
+            std::string directory = kCgroupRoot + line.substr(3);
+            while (directory.size() > kCgroupRoot.size() && directory.back() == '/') {
+               directory.pop_back();
+            }
+            return directory;
+         }
+      }
+      return "";
+   }
+
+   /// @return the whitespace separated number @param field of the file at @param fd, 0 if missing
+   uint64_t ReadNumber(int fd, size_t field) {
+      char text[128];
+      const ssize_t length = pread(fd, text, sizeof(text) - 1, 0);
+      if (length <= 0) {
+         return 0;
+      }
+      text[length] = '\0';
+      char* position = text;
+      uint64_t value = 0;
+      for (size_t index = 0; index <= field; ++index) {
+         char* end = position;
+         value = strtoull(position, &end, 10);
+         if (end == position) {
+            return 0;
+         }
+         position = end;
+      }
+      return value;
+   }
+
+   /**
+    * The cgroup whose memory.max is the tightest, walking from this process's
+    * cgroup up to the root. A limit on any ancestor applies to its whole
+    * subtree, so usage is measured there too
+    * @param limit set to that memory.max, 0 if no cgroup on the way is limited
+    * @return its directory, empty if none is limited
+    */
+   std::string LimitingCgroup(uint64_t& limit) {
+      limit = 0;
+      std::string limiting;
+      std::string directory = CgroupDirectory();
+      while (directory.size() >= kCgroupRoot.size()) {
+         const int fd = open((directory + "/memory.max").c_str(), O_RDONLY | O_CLOEXEC);
+         if (fd >= 0) {
+            const uint64_t value = ReadNumber(fd, 0);  // "max" reads as 0
+            close(fd);
+            if (value != 0 && (limit == 0 || value < limit)) {
+               limit = value;
+               limiting = directory;
+            }
+         }
+         if (directory.size() == kCgroupRoot.size()) {
+            break;
+         }
+         directory.erase(directory.rfind('/'));
+      }
+      return limiting;
+   }
+
+   void Monitor(std::chrono::milliseconds interval, uint64_t shedBytes, uint64_t deathBytes) {
+      bool shed = false;
+      bool reported = false;
+      std::unique_lock<std::mutex> lock(gGuardLock);
+      while (!gGuardWake.wait_for(lock, interval, [] { return gStopMonitor; })) {
+         const uint64_t usage = MemoryGuard::Usage();
+         if (shedBytes > 0 && usage >= shedBytes && !shed) {
+            shed = true;
+            const std::vector<ShedEvent> events = gShedEvents;
+            lock.unlock();
+            for (const auto& event : events) {
+               (event.function)(event.argument);
+            }
+            lock.lock();
+            continue;  // sample again before deciding to die
+         }
+         shed = shed && usage >= shedBytes;
+         if (usage >= deathBytes && !reported) {
+            reported = true;
+            char reason[160];
+            snprintf(reason, sizeof(reason), "MEMORY: %s usage %llu bytes crossed %llu of limit %llu",
+                    gUsingCgroup.load() ? "cgroup" : "rss", static_cast<unsigned long long>(usage),
+                    static_cast<unsigned long long>(deathBytes), static_cast<unsigned long long>(gLimit.load()));
+            lock.unlock();
+            Death::SyntheticFatal(__FILE__, __LINE__, __func__, reason);
+            lock.lock();
+         }
+         reported = reported && usage >= deathBytes;
+      }
+   }
+}
+
+/**
+ * Start watching memory
+ * @param limitBytes 0 uses the tightest cgroup v2 memory.max of this process or an ancestor
+ * @param interval sampling period
+ * @param shedRatio fraction of the limit that runs the shed callbacks, 0 for none
+ * @param deathRatio fraction of the limit that raises the fatal, keep it below 1
+ *    for a cgroup limit so the fatal wins the race with the OOM killer
+ * @return false if already running, no cgroup limit is set or usage cannot be read
+ */
+bool MemoryGuard::Start(uint64_t limitBytes, std::chrono::milliseconds interval, double shedRatio, double deathRatio) {
+   std::lock_guard<std::mutex> glock(gGuardLock);
+   if (gMonitor.joinable()) {
+      return false;
+   }
+   const bool useCgroup = (limitBytes == 0);
+   std::string limiting;
+   if (useCgroup) {
+      limiting = LimitingCgroup(limitBytes);
+      if (limitBytes == 0) {
+         return false;
+      }
+   }
+   const std::string usagePath = useCgroup ? limiting + "/memory.current" : "/proc/self/statm";
+   const int fd = open(usagePath.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      return false;
+   }
+   gUsageFd.store(fd);
+   gUsingCgroup.store(useCgroup);
+   gLimit.store(limitBytes);
+   gStopMonitor = false;
+   gMonitor = std::thread(&Monitor, interval, static_cast<uint64_t>(limitBytes * shedRatio),
+           static_cast<uint64_t>(limitBytes * deathRatio));
+   return true;
+}
+
+void MemoryGuard::Stop() {
+   std::thread monitor;
+   {
+      std::lock_guard<std::mutex> glock(gGuardLock);
+      gStopMonitor = true;
+      monitor.swap(gMonitor);
+   }
+   gGuardWake.notify_all();
+   if (monitor.joinable()) {
+      monitor.join();
+   }
+   const int fd = gUsageFd.exchange(-1);
+   if (fd >= 0) {
+      close(fd);
+   }
+}
+
+/// Runs on the monitor thread when usage crosses the shed threshold
+void MemoryGuard::RegisterShedEvent(Death::DeathCallbackType shedFunction, const Death::DeathCallbackArg& shedArg) {
+   std::lock_guard<std::mutex> glock(gGuardLock);
+   gShedEvents.push_back({shedFunction, shedArg});
+}
+
+void MemoryGuard::ClearShedEvents() {
+   std::lock_guard<std::mutex> glock(gGuardLock);
+   gShedEvents.clear();
+}
+
+/// @return bytes in use by the source the guard watches, 0 when stopped
+uint64_t MemoryGuard::Usage() {
+   const int fd = gUsageFd.load();
+   if (fd < 0) {
+      return 0;
+   }
+   if (gUsingCgroup.load()) {
+      return ReadNumber(fd, 0);
+   }
+   static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+   return ReadNumber(fd, 1) * pageSize;  // statm: size resident ...
+}
+
+uint64_t MemoryGuard::Limit() {
+   return gLimit.load();
+}
+
+bool MemoryGuard::UsingCgroup() {
+   return gUsingCgroup.load();
+}
+
+/// @return the tightest cgroup v2 memory.max of this process and its ancestors, 0 if unlimited or unknown
+uint64_t MemoryGuard::CgroupLimit() {
+   uint64_t limit = 0;
+   LimitingCgroup(limit);
+   return limit;
+}
+
+/**
+ * Child side of fork(), called by Death. The monitor thread was not copied and
+ * may have held the lock, the handle, lock and condition are replaced without
+ * joining or unlocking anything. The usage descriptor is forgotten, not closed,
+ * so the child starts out stopped and @ref Start works there
+ */
+void MemoryGuard::AfterFork() {
+   new (&gMonitor) std::thread();
+   new (&gGuardLock) std::mutex();
+   new (&gGuardWake) std::condition_variable();
+   gStopMonitor = false;
+   gUsageFd.store(-1);
+   gUsingCgroup.store(false);
+   gLimit.store(0);
+}
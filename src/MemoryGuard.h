@@ -0,0 +1,32 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "Death.h"
+
+/**
+ * Dies in a controlled way before the kernel OOM killer sends SIGKILL, which
+ * no death hook survives.
+ *
+ * A monitor thread samples memory usage: the cgroup v2 memory.current of the
+ * cgroup with the tightest memory.max, this process's or an ancestor's, when
+ * the limit comes from the cgroup, otherwise the process RSS from
+ * /proc/self/statm. The files stay open, a sample is one pread.
+ *
+ * Crossing shedRatio * limit runs the registered shed callbacks once, e.g. to
+ * drop caches, re-armed when usage falls back below. Crossing
+ * deathRatio * limit raises a synthetic fatal through Death.
+ */
+class MemoryGuard {
+public:
+   static bool Start(uint64_t limitBytes, std::chrono::milliseconds interval,
+           double shedRatio = 0.0, double deathRatio = 1.0);
+   static void Stop();
+   static void RegisterShedEvent(Death::DeathCallbackType shedFunction, const Death::DeathCallbackArg& shedArg);
+   static void ClearShedEvents();
+   static uint64_t Usage();
+   static uint64_t Limit();
+   static bool UsingCgroup();
+   static uint64_t CgroupLimit();
+   static void AfterFork();
+};
@@ -0,0 +1,169 @@
+
+#include "SocketRegistry.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+const size_t SocketRegistry::kMaxSockets;
+
+namespace {
+   enum SlotState : int { kFree = 0, kClaimed, kReady };
+
+   struct Socket {
+      std::atomic<int> state;
+      int fd;
+      uint16_t port;
+      pid_t owner;
+   };
+
+   struct ClosedSocket {
+      uint16_t port;
+      int error;
+   };
+
+   Socket gSockets[SocketRegistry::kMaxSockets];
+   ClosedSocket gClosed[SocketRegistry::kMaxSockets];
+   std::atomic<size_t> gClosedCount{0};
+   std::atomic<int> gPortFd{-1};
+   std::atomic<pid_t> gPortOwner{0};
+
+   uint16_t LocalPort(int fd) {
+      sockaddr_storage address{};
+      socklen_t length = sizeof(address);
+      if (getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+         return 0;
+      }
+      if (address.ss_family == AF_INET) {
+         return ntohs(reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+      }
+      if (address.ss_family == AF_INET6) {
+         return ntohs(reinterpret_cast<sockaddr_in6*>(&address)->sin6_port);
+      }
+      return 0;
+   }
+
+   /// write(2) a decimal port and a newline
+   void WritePort(int fd, uint16_t port) {
+      char text[8];
+      const int length = snprintf(text, sizeof(text), "%u\n", static_cast<unsigned>(port));
+      if (length > 0 && write(fd, text, length) < 0) {
+         return;
+      }
+   }
+}
+
+/**
+ * @param fd a connected or listening socket, its local port is read now
+ * @return id for @ref Unregister, -1 when the table is full
+ */
+int SocketRegistry::Register(int fd) {
+   for (size_t id = 0; id < kMaxSockets; ++id) {
+      int expected = kFree;
+      if (gSockets[id].state.compare_exchange_strong(expected, kClaimed)) {
+         gSockets[id].fd = fd;
+         gSockets[id].port = LocalPort(fd);
+         gSockets[id].owner = getpid();
+         gSockets[id].state.store(kReady, std::memory_order_release);
+         return static_cast<int>(id);
+      }
+   }
+   return -1;
+}
+
+void SocketRegistry::Unregister(int id) {
+   if (id >= 0 && static_cast<size_t>(id) < kMaxSockets) {
+      gSockets[id].state.store(kFree, std::memory_order_release);
+   }
+}
+
+void SocketRegistry::Clear() {
+   for (auto& socket : gSockets) {
+      socket.state.store(kFree, std::memory_order_release);
+   }
+}
+
+/**
+ * Open, and truncate, the file that @ref AbortAll writes the closed ports to.
+ * It is opened now so that death needs no open(). Empty path stops writing
+ */
+bool SocketRegistry::SetPortFile(const std::string& path) {
+   const int fd = path.empty() ? -1 : open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+   gPortOwner.store(getpid());
+   const int previous = gPortFd.exchange(fd);
+   if (previous >= 0) {
+      close(previous);
+   }
+   return path.empty() || fd >= 0;
+}
+
+/**
+ * Reset and close every socket this process registered, called by
+ * Death::Received. Entries inherited across fork() are skipped, the linger
+ * option and the port file would act on the parent's sockets
+ * @return sockets closed
+ */
+size_t SocketRegistry::AbortAll() {
+   const linger abortive{1, 0};
+   const pid_t pid = getpid();
+   const int portFd = (gPortOwner.load() == pid) ? gPortFd.load() : -1;
+   size_t closed = 0;
+   for (auto& socket : gSockets) {
+      int expected = kReady;
+      if (!socket.state.compare_exchange_strong(expected, kClaimed, std::memory_order_acquire)) {
+         continue;
+      }
+      if (socket.owner != pid) {
+         socket.state.store(kReady, std::memory_order_release);
+         continue;
+      }
+      const int fd = socket.fd;
+      const uint16_t port = socket.port;
+      socket.state.store(kFree, std::memory_order_release);
+      setsockopt(fd, SOL_SOCKET, SO_LINGER, &abortive, sizeof(abortive));
+      gClosed[closed] = {port, close(fd) == 0 ? 0 : errno};
+      ++closed;
+      if (portFd >= 0 && port != 0) {
+         WritePort(portFd, port);
+      }
+   }
+   if (portFd >= 0) {
+      fsync(portFd);
+   }
+   gClosedCount.store(closed, std::memory_order_release);
+   return closed;
+}
+
+/// Sockets closed by the last @ref AbortAll
+std::vector<SocketRegistry::Closed> SocketRegistry::LastClosed() {
+   std::vector<Closed> closed;
+   const size_t count = gClosedCount.load(std::memory_order_acquire);
+   for (size_t index = 0; index < count; ++index) {
+      closed.push_back({gClosed[index].port, gClosed[index].error});
+   }
+   return closed;
+}
+
+/// For the restarted process: the ports its predecessor held when it died
+std::vector<uint16_t> SocketRegistry::PortsToRebind(const std::string& path) {
+   std::vector<uint16_t> ports;
+   std::ifstream file(path);
+   unsigned port = 0;
+   while (file >> port) {
+      ports.push_back(static_cast<uint16_t>(port));
+   }
+   return ports;
+}
+
+/// SO_REUSEADDR and SO_REUSEPORT on a socket that is about to bind a port from @ref PortsToRebind
+bool SocketRegistry::PrepareRebind(int fd) {
+   const int enable = 1;
+   bool prepared = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == 0;
+#ifdef SO_REUSEPORT
+   prepared = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == 0 && prepared;
+#endif
+   return prepared;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Network sockets that Death::Received closes abortively, before the death
+ * callbacks run: SO_LINGER{1, 0} makes close() reset the connection instead
+ * of leaving it in TIME_WAIT or lingering on unsent data, so the port is
+ * free for the replacement process straight away.
+ *
+ * The local ports of the closed sockets can be written to a port file. The
+ * restarted process reads it with @ref PortsToRebind and calls
+ * @ref PrepareRebind on its new sockets before bind().
+ *
+ * The table is fixed size and lock free. Unregister a socket before closing
+ * it, a registered descriptor is closed at death whatever it refers to by then.
+ * Entries and the port file belong to the process that registered them, a
+ * forked child that dies leaves the sockets it shares with its parent alone.
+ */
+class SocketRegistry {
+public:
+   static const size_t kMaxSockets = 128;
+
+   struct Closed {
+      uint16_t port;
+      int error;     // 0, or errno of the close
+   };
+
+   static int Register(int fd);
+   static void Unregister(int id);
+   static void Clear();
+   static bool SetPortFile(const std::string& path);
+
+   static size_t AbortAll();
+   static std::vector<Closed> LastClosed();
+
+   static std::vector<uint16_t> PortsToRebind(const std::string& path);
+   static bool PrepareRebind(int fd);
+};
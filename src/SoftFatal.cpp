@@ -0,0 +1,86 @@
+
+#include "SoftFatal.h"
+#include "Death.h"
+#include <chrono>
+#include <ctime>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const uint32_t SoftFatalSite::kKeptRecords;
+
+namespace {
+   std::atomic<SoftFatalSite*> gSoftSites{nullptr};
+   std::atomic<uint32_t> gPromotionThreshold{0};
+
+   uint64_t RealtimeNs() {
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+   }
+
+   /// @return violations counted in the current one second window, this one included
+   uint32_t CountInWindow(SoftFatalSite& site) {
+      const uint64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+              std::chrono::steady_clock::now().time_since_epoch()).count();
+      uint64_t window = site.windowSecond.load(std::memory_order_relaxed);
+      if (window != second && site.windowSecond.compare_exchange_strong(window, second)) {
+         site.windowCount.store(0, std::memory_order_relaxed);
+      }
+      return site.windowCount.fetch_add(1, std::memory_order_relaxed) + 1;
+   }
+}
+
+/**
+ * Slow path of a failed soft check: count, keep a record if there is room left
+ * and promote to a hard death if the site's rate is exceeded
+ */
+void SoftFatal::Violation(SoftFatalSite& site, const char* function) {
+   if (!site.registered.exchange(true)) {
+      SoftFatalSite* head = gSoftSites.load();
+      do {
+         site.next.store(head, std::memory_order_relaxed);
+      } while (!gSoftSites.compare_exchange_weak(head, &site));
+   }
+
+   const uint64_t violations = site.violations.fetch_add(1, std::memory_order_relaxed) + 1;
+   const uint32_t slot = site.recordsClaimed.fetch_add(1, std::memory_order_relaxed);
+   if (slot < SoftFatalSite::kKeptRecords) {
+      auto& record = site.records[slot];
+      record.realtimeNs = RealtimeNs();
+      record.threadId = static_cast<uint64_t>(syscall(SYS_gettid));
+      record.published.store(true, std::memory_order_release);
+   }
+
+   const uint32_t threshold = site.promoteAbove ? site.promoteAbove : gPromotionThreshold.load(std::memory_order_relaxed);
+   const uint32_t inWindow = CountInWindow(site);
+   if (threshold != 0 && inWindow > threshold) {
+      Death::SyntheticFatal(site.site.file, site.site.line, function,
+              "Soft fatal promoted: (" + std::string(site.site.expression) + ") violated " +
+              std::to_string(inWindow) + " times within one second, " + std::to_string(violations) + " in total");
+   }
+}
+
+/// Violations per second above which DK_SOFT_CHECK sites die for real, 0 never promotes
+void SoftFatal::SetPromotionThreshold(uint32_t violationsPerSecond) {
+   gPromotionThreshold.store(violationsPerSecond);
+}
+
+uint32_t SoftFatal::PromotionThreshold() {
+   return gPromotionThreshold.load();
+}
+
+/// Lock free, sites that never failed are not listed
+std::vector<SoftFatal::SiteSnapshot> SoftFatal::Snapshot() {
+   std::vector<SiteSnapshot> sites;
+   for (auto site = gSoftSites.load(std::memory_order_acquire); site != nullptr; site = site->next.load()) {
+      SiteSnapshot snapshot{site->site.file, site->site.line, site->site.expression,
+         site->violations.load(std::memory_order_relaxed), {}};
+      for (const auto& record : site->records) {
+         if (record.published.load(std::memory_order_acquire)) {
+            snapshot.records.push_back({record.realtimeNs, record.threadId});
+         }
+      }
+      sites.push_back(std::move(snapshot));
+   }
+   return sites;
+}
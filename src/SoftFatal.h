@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "DeathCheck.h"
+
+/**
+ * Soft fatal sites count contract violations instead of dying.
+ *
+ *    DK_SOFT_CHECK(response.size() < kLimit);
+ *    DK_SOFT_CHECK_RATE(100, session != nullptr);   // hard death above 100 violations/s
+ *
+ * Each site keeps lock-free counters and the first few violations as structured
+ * records. A site is promoted to a hard @ref Death when its violations within
+ * one second exceed its threshold, DK_SOFT_CHECK uses the global threshold.
+ */
+struct SoftFatalSite {
+   static const uint32_t kKeptRecords = 4;
+
+   struct Record {
+      std::atomic<bool> published;
+      uint64_t realtimeNs;
+      uint64_t threadId;
+   };
+
+   constexpr SoftFatalSite(const char* file, int line, const char* expression, uint32_t promoteAbove)
+      : site{file, line, expression}, promoteAbove(promoteAbove), violations(0), windowSecond(0), windowCount(0),
+        recordsClaimed(0), records{}, next(nullptr), registered(false) {}
+
+   const DeathCheckSite site;
+   const uint32_t promoteAbove;   // violations per second, 0 uses the global threshold
+   std::atomic<uint64_t> violations;
+   std::atomic<uint64_t> windowSecond;
+   std::atomic<uint32_t> windowCount;
+   std::atomic<uint32_t> recordsClaimed;
+   Record records[kKeptRecords];
+   std::atomic<SoftFatalSite*> next;
+   std::atomic<bool> registered;
+};
+
+class SoftFatal {
+public:
+   struct RecordSnapshot {
+      uint64_t realtimeNs;
+      uint64_t threadId;
+   };
+
+   struct SiteSnapshot {
+      std::string file;
+      int line;
+      std::string expression;
+      uint64_t violations;
+      std::vector<RecordSnapshot> records;
+   };
+
+   static void Violation(SoftFatalSite& site, const char* function) __attribute__((noinline, cold));
+   static void SetPromotionThreshold(uint32_t violationsPerSecond);
+   static uint32_t PromotionThreshold();
+   static std::vector<SiteSnapshot> Snapshot();
+};
+
+#define DK_SOFT_CHECK_RATE(promoteAbove, expression) \
+   do { \
+      if (DK_UNLIKELY(!(expression))) { \
+         static SoftFatalSite dkSoftSite{__FILE__, __LINE__, #expression, (promoteAbove)}; \
+         SoftFatal::Violation(dkSoftSite, __func__); \
+      } \
+   } while (0)
+
+#define DK_SOFT_CHECK(expression) DK_SOFT_CHECK_RATE(0, expression)
@@ -0,0 +1,232 @@
+
+#include "SpillQueues.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+const size_t SpillQueues::kMaxQueues;
+const size_t SpillQueues::kBatchEvents;
+const uint32_t SpillQueues::kBatchMagic;
+
+static_assert(SpillQueues::kBatchEvents + 2 <= IOV_MAX, "a batch is written with a single writev");
+
+namespace {
+   enum SlotState : int { kFree = 0, kClaimed, kReady };
+
+   struct Queue {
+      std::atomic<int> state;
+      uint32_t queueId;
+      SpillQueues::Cursor cursor;
+      void* context;
+   };
+
+   Queue gQueues[SpillQueues::kMaxQueues];
+   std::atomic<int> gSpillFd{-1};
+   std::atomic<pid_t> gSpillOwner{0};
+
+   /// Only touched at death, static so that the spill never allocates
+   iovec gVectors[SpillQueues::kBatchEvents + 2];
+   uint32_t gLengths[SpillQueues::kBatchEvents];
+   SpillQueues::Totals gLastSpill{0, 0, 0, 0};
+
+   /// writev all of @param vectors, resuming after short writes
+   bool WriteAll(int fd, iovec* vectors, int count) {
+      while (count > 0) {
+         const ssize_t written = writev(fd, vectors, count);
+         if (written < 0) {
+            if (errno == EINTR) {
+               continue;
+            }
+            return false;
+         }
+         size_t remaining = static_cast<size_t>(written);
+         while (count > 0 && remaining >= vectors->iov_len) {
+            remaining -= vectors->iov_len;
+            ++vectors;
+            --count;
+         }
+         if (count > 0) {
+            vectors->iov_base = static_cast<char*>(vectors->iov_base) + remaining;
+            vectors->iov_len -= remaining;
+         }
+      }
+      return true;
+   }
+}
+
+/**
+ * Create the spill file and reserve @param bytes on disk for it, so that
+ * the writes at death do not fail on allocation. An existing file is
+ * truncated, @ref Replay it first
+ */
+bool SpillQueues::Prepare(const std::string& path, size_t bytes) {
+   const int fd = open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0) {
+      return false;
+   }
+   if (bytes > 0 && posix_fallocate(fd, 0, bytes) != 0) {
+      close(fd);
+      return false;
+   }
+   gSpillOwner.store(getpid());
+   const int previous = gSpillFd.exchange(fd);
+   if (previous >= 0) {
+      close(previous);
+   }
+   return true;
+}
+
+/**
+ * @param queueId written with each batch, identifies the queue at replay
+ * @return id for @ref Unregister, -1 when the table is full
+ */
+int SpillQueues::Register(uint32_t queueId, Cursor cursor, void* context) {
+   for (size_t id = 0; id < kMaxQueues; ++id) {
+      int expected = kFree;
+      if (gQueues[id].state.compare_exchange_strong(expected, kClaimed)) {
+         gQueues[id].queueId = queueId;
+         gQueues[id].cursor = cursor;
+         gQueues[id].context = context;
+         gQueues[id].state.store(kReady, std::memory_order_release);
+         return static_cast<int>(id);
+      }
+   }
+   return -1;
+}
+
+void SpillQueues::Unregister(int id) {
+   if (id >= 0 && static_cast<size_t>(id) < kMaxQueues) {
+      gQueues[id].state.store(kFree, std::memory_order_release);
+   }
+}
+
+void SpillQueues::Clear() {
+   for (auto& queue : gQueues) {
+      queue.state.store(kFree, std::memory_order_release);
+   }
+}
+
+/// true when this process prepared a spill file and there is at least one queue
+bool SpillQueues::HasQueues() {
+   if (gSpillFd.load() < 0 || gSpillOwner.load() != getpid()) {
+      return false;
+   }
+   for (const auto& queue : gQueues) {
+      if (queue.state.load(std::memory_order_acquire) == kReady) {
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * Drain every registered cursor into the spill file from its start, then
+ * fdatasync it. Called by Death::Received, not safe to run concurrently.
+ * Until it returns LastSpill reports ECANCELED, which is what a crash record
+ * shows if a cursor raises a fatal
+ */
+SpillQueues::Totals SpillQueues::SpillAll() {
+   Totals totals{0, 0, 0, 0};
+   gLastSpill = Totals{0, 0, 0, ECANCELED};
+   // a forked child shares the file offset and contents with its parent
+   const int fd = (gSpillOwner.load() == getpid()) ? gSpillFd.load() : -1;
+   if (fd < 0 || lseek(fd, 0, SEEK_SET) != 0) {
+      totals.error = (fd < 0) ? EBADF : errno;
+      gLastSpill = totals;
+      return totals;
+   }
+   BatchHeader header{kBatchMagic, 0, 0, 0, 0};
+   for (const auto& queue : gQueues) {
+      if (queue.state.load(std::memory_order_acquire) != kReady) {
+         continue;
+      }
+      ++totals.queues;
+      size_t events = 0;
+      while (totals.error == 0 && (events = queue.cursor(queue.context, gVectors + 2, kBatchEvents)) > 0) {
+         if (events > kBatchEvents) {
+            totals.error = EINVAL;
+            break;
+         }
+         header.queueId = queue.queueId;
+         header.events = static_cast<uint32_t>(events);
+         header.bytes = 0;
+         for (size_t event = 0; event < events; ++event) {
+            gLengths[event] = static_cast<uint32_t>(gVectors[event + 2].iov_len);
+            header.bytes += gVectors[event + 2].iov_len;
+         }
+         gVectors[0] = {&header, sizeof(header)};
+         gVectors[1] = {gLengths, events * sizeof(uint32_t)};
+         if (!WriteAll(fd, gVectors, static_cast<int>(events + 2))) {
+            totals.error = errno;
+            break;
+         }
+         totals.events += events;
+         totals.bytes += header.bytes;
+      }
+   }
+   BatchHeader end{kBatchMagic, 0, 0, 0, 0};
+   iovec terminator{&end, sizeof(end)};
+   if (!WriteAll(fd, &terminator, 1) || fdatasync(fd) != 0) {
+      totals.error = (totals.error != 0) ? totals.error : errno;
+   }
+   gLastSpill = totals;
+   return totals;
+}
+
+/// Totals of the last @ref SpillAll
+SpillQueues::Totals SpillQueues::LastSpill() {
+   return gLastSpill;
+}
+
+/**
+ * For the restarted process: hand every spilled event to @param replay in
+ * the order it was queued
+ * @return events replayed, -1 if the file cannot be opened. A truncated file
+ *    replays the complete batches before the damage, a batch whose header
+ *    claims more than the rest of the file ends the replay
+ */
+int64_t SpillQueues::Replay(const std::string& path, const ReplayFunction& replay) {
+   const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      return -1;
+   }
+   struct stat status;
+   if (fstat(fd, &status) != 0) {
+      close(fd);
+      return -1;
+   }
+   uint64_t remaining = static_cast<uint64_t>(status.st_size);
+   int64_t replayed = 0;
+   std::vector<uint32_t> lengths;
+   std::vector<char> data;
+   BatchHeader header;
+   while (remaining >= sizeof(header) && read(fd, &header, sizeof(header)) == sizeof(header) &&
+           header.magic == kBatchMagic && header.events > 0) {
+      remaining -= sizeof(header);
+      const size_t lengthBytes = static_cast<size_t>(header.events) * sizeof(uint32_t);
+      if (lengthBytes > remaining || header.bytes > remaining - lengthBytes) {
+         break;
+      }
+      remaining -= lengthBytes + header.bytes;
+      lengths.resize(header.events);
+      data.resize(header.bytes);
+      if (read(fd, lengths.data(), lengthBytes) != static_cast<ssize_t>(lengthBytes) ||
+              read(fd, data.data(), header.bytes) != static_cast<ssize_t>(header.bytes)) {
+         break;
+      }
+      size_t offset = 0;
+      for (const uint32_t length : lengths) {
+         if (offset + length > data.size()) {
+            break;
+         }
+         replay(header.queueId, data.data() + offset, length);
+         offset += length;
+         ++replayed;
+      }
+   }
+   close(fd);
+   return replayed;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <sys/uio.h>
+
+/**
+ * In-memory queues that Death::Received writes to disk, so buffered events
+ * survive the crash and can be replayed by the restarted process.
+ *
+ * A queue is registered as a cursor: at death it is called repeatedly to fill
+ * an array of iovecs that point straight into the queue's memory, one iovec
+ * per event, until it returns 0. The cursor runs on the dying thread and must
+ * not allocate or lock. The events are written with writev into a spill file
+ * that @ref Prepare opened and preallocated, so the spill itself neither
+ * copies event data nor allocates.
+ *
+ * Spill file: batches of {BatchHeader, u32 length per event, event bytes},
+ * then a BatchHeader with no events. Read it back with @ref Replay before
+ * calling @ref Prepare, which truncates it. The spill file belongs to the
+ * process that prepared it, a forked child does not spill into it.
+ */
+class SpillQueues {
+public:
+   typedef size_t (*Cursor)(void* context, iovec* events, size_t maxEvents);
+   typedef std::function<void(uint32_t queueId, const char* event, size_t length)> ReplayFunction;
+
+   static const size_t kMaxQueues = 32;
+   static const size_t kBatchEvents = 512;
+   static const uint32_t kBatchMagic = 0x5153444B; // "DKSQ"
+
+#pragma pack(push, 1)
+   struct BatchHeader {
+      uint32_t magic;
+      uint32_t queueId;
+      uint32_t events;     // 0 ends the file
+      uint32_t reserved;
+      uint64_t bytes;      // event bytes after the length array
+   };
+#pragma pack(pop)
+
+   struct Totals {
+      uint32_t queues;
+      uint64_t events;
+      uint64_t bytes;
+      int error;           // errno of the first failed write, EINVAL for a cursor past maxEvents, 0 if none
+   };
+
+   static bool Prepare(const std::string& path, size_t bytes);
+   static int Register(uint32_t queueId, Cursor cursor, void* context);
+   static void Unregister(int id);
+   static void Clear();
+   static bool HasQueues();
+
+   static Totals SpillAll();
+   static Totals LastSpill();
+   static int64_t Replay(const std::string& path, const ReplayFunction& replay);
+};
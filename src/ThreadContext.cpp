@@ -0,0 +1,156 @@
+
+#include "ThreadContext.h"
+#include <cstring>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const size_t ThreadContextSlot::kTags;
+const size_t ThreadContextSlot::kNameSize;
+const pid_t ThreadContextSlot::kClaiming;
+const size_t ThreadContext::kMaxThreads;
+const size_t ThreadContext::kLabelSize;
+
+thread_local ThreadContextSlot* ThreadContext::mSlot = nullptr;
+
+namespace {
+   ThreadContextSlot gSlots[ThreadContext::kMaxThreads];
+   ThreadContextSlot gOverflowSlot;
+
+   void ResetSlot(ThreadContextSlot& slot) {
+      slot.label.store(nullptr, std::memory_order_relaxed);
+      for (auto& tag : slot.tags) {
+         tag.store(0, std::memory_order_relaxed);
+      }
+   }
+
+   void ReleaseSlot(ThreadContextSlot& slot) {
+      ResetSlot(slot);
+      slot.role.store(nullptr, std::memory_order_relaxed);
+      slot.nameLength.store(0, std::memory_order_relaxed);
+      slot.freezable.store(false, std::memory_order_relaxed);
+      slot.budgetNs.store(0, std::memory_order_relaxed);
+      slot.tid.store(0, std::memory_order_release);
+   }
+
+   /// CLOCK_THREAD_CPUTIME_ID is no fallback, read at death it is the dying thread's clock
+   void BindCpuClock(ThreadContextSlot& slot) {
+      slot.hasCpuClock = pthread_getcpuclockid(pthread_self(), &slot.cpuClock) == 0;
+   }
+}
+
+/// Gives the slot back when its thread exits, later stores go to the scratch slot
+struct ThreadContext::Owner {
+   ThreadContextSlot* slot = nullptr;
+
+   ~Owner() {
+      mSlot = &gOverflowSlot;
+      if (slot != nullptr && slot != &gOverflowSlot) {
+         ReleaseSlot(*slot);
+      }
+   }
+};
+
+/**
+ * First use on a thread, a linear scan for a free slot. The slot is held as
+ * kClaiming while it is set up, Snapshot only sees it once the tid is published
+ */
+ThreadContextSlot& ThreadContext::Claim() {
+   thread_local Owner owner;
+   const pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+   ThreadContextSlot* claimed = &gOverflowSlot;
+   for (auto& slot : gSlots) {
+      pid_t expected = 0;
+      if (slot.tid.load(std::memory_order_relaxed) == 0 &&
+              slot.tid.compare_exchange_strong(expected, ThreadContextSlot::kClaiming, std::memory_order_acquire)) {
+         ResetSlot(slot);
+         BindCpuClock(slot);
+         slot.tid.store(tid, std::memory_order_release);
+         claimed = &slot;
+         break;
+      }
+   }
+   owner.slot = claimed;
+   mSlot = claimed;
+   return *claimed;
+}
+
+/**
+ * Name the calling thread for crash reports, typically once as it starts.
+ * @param name is copied, truncated to 15 characters, and also given to
+ *    pthread_setname_np so tools like top show it
+ * @param role e.g. the pool the thread belongs to, must outlive the thread
+ */
+void ThreadContext::SetName(const char* name, const char* role) {
+   ThreadContextSlot& slot = Slot();
+   const size_t length = strnlen(name, ThreadContextSlot::kNameSize - 1);
+   slot.nameLength.store(0, std::memory_order_relaxed);
+   memcpy(slot.name, name, length);
+   slot.name[length] = '\0';
+   slot.nameLength.store(length, std::memory_order_release);
+   slot.role.store(role, std::memory_order_relaxed);
+   pthread_setname_np(pthread_self(), slot.name);
+}
+
+/// Opt the calling thread in to Death's stop-the-world freeze
+void ThreadContext::SetFreezable(bool freezable) {
+   Slot().freezable.store(freezable, std::memory_order_relaxed);
+}
+
+/// Reset the calling thread's tags and label, it keeps its slot and name
+void ThreadContext::Clear() {
+   ResetSlot(Slot());
+}
+
+/**
+ * In a forked child only the forking thread exists. Its slot is moved to the
+ * child's tid and clock, every other slot is released so that a freeze or
+ * watchdog in the child does not wait for the parent's threads
+ */
+void ThreadContext::AfterFork() {
+   const pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+   for (auto& slot : gSlots) {
+      if (&slot == mSlot) {
+         slot.tid.store(ThreadContextSlot::kClaiming, std::memory_order_relaxed);
+         BindCpuClock(slot);
+         slot.tid.store(tid, std::memory_order_release);
+      } else if (slot.tid.load(std::memory_order_relaxed) != 0) {
+         ReleaseSlot(slot);
+      }
+   }
+}
+
+/// Raw table access for monitors, check tid for whether the slot is in use
+ThreadContextSlot& ThreadContext::SlotAt(size_t index) {
+   return gSlots[index];
+}
+
+/**
+ * Copy every claimed slot and read each thread's CPU time. Values are read
+ * with relaxed loads while their threads keep running, each tag is
+ * consistent on its own. A thread renamed during the copy may show a mixed name
+ */
+void ThreadContext::Snapshot(std::vector<Record>& records) {
+   records.clear();
+   for (const auto& slot : gSlots) {
+      const pid_t tid = slot.tid.load(std::memory_order_acquire);
+      if (tid <= 0) {
+         continue;
+      }
+      Record record;
+      record.tid = tid;
+      for (size_t index = 0; index < ThreadContextSlot::kTags; ++index) {
+         record.tags[index] = slot.tags[index].load(std::memory_order_relaxed);
+      }
+      record.label = slot.label.load(std::memory_order_relaxed);
+      const uint32_t nameLength = slot.nameLength.load(std::memory_order_acquire);
+      memcpy(record.name, slot.name, nameLength);
+      record.name[nameLength] = '\0';
+      record.role = slot.role.load(std::memory_order_relaxed);
+      record.freezable = slot.freezable.load(std::memory_order_relaxed);
+      timespec cpu{0, 0};
+      record.cpuNs = (slot.hasCpuClock && clock_gettime(slot.cpuClock, &cpu) == 0)
+              ? cpu.tv_sec * 1000000000ull + cpu.tv_nsec : 0;
+      records.push_back(record);
+   }
+}
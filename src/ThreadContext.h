@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+#include <time.h>
+
+/**
+ * Per-thread attribution context copied into the crash record, e.g. the
+ * request, tenant and connection a thread is serving when the process dies.
+ *
+ * A thread claims a slot from a fixed table on its first use and gives it back
+ * when it exits. After that, setting a tag or the label is a thread_local load
+ * and a relaxed store. Labels must be string literals or otherwise outlive the
+ * thread, only the pointer is stored.
+ *
+ * The same slot carries the thread's name and role, set once when the thread
+ * starts, and the clock used to report its CPU time at death.
+ *
+ * Threads beyond kMaxThreads share a scratch slot that is never recorded.
+ */
+struct alignas(64) ThreadContextSlot {
+   static const size_t kTags = 4;
+   static const size_t kNameSize = 16;         // pthread name limit, including the terminator
+   static const pid_t kClaiming = -1;
+
+   std::atomic<pid_t> tid;                     // 0 while the slot is free, kClaiming until the slot is set up
+   std::atomic<const char*> label;
+   std::atomic<uint64_t> tags[kTags];
+   std::atomic<const char*> role;
+   std::atomic<uint32_t> nameLength;           // published after name is written
+   char name[kNameSize];
+   clockid_t cpuClock;                         // published by tid
+   bool hasCpuClock;                           // false if the clock id could not be read, CPU time is reported as 0
+   std::atomic<bool> freezable;                // stopped by Death's freeze, see Death::SetupDeathFreeze
+   alignas(64) std::atomic<uint64_t> heartbeat; // only the owner writes, see Watchdog
+   std::atomic<uint64_t> budgetNs;              // 0 when the watchdog ignores the thread
+};
+
+class ThreadContext {
+public:
+   static const size_t kMaxThreads = 256;
+   static const size_t kLabelSize = 64;       // recorded label length limit
+
+   struct Record {
+      pid_t tid;
+      uint64_t tags[ThreadContextSlot::kTags];
+      const char* label;
+      char name[ThreadContextSlot::kNameSize];
+      const char* role;
+      uint64_t cpuNs;                         // 0 when unknown
+      bool freezable;
+   };
+
+   static ThreadContextSlot& Slot() {
+      ThreadContextSlot* slot = mSlot;
+      return slot != nullptr ? *slot : Claim();
+   }
+
+   /// @param index below ThreadContextSlot::kTags
+   static void SetTag(size_t index, uint64_t value) {
+      Slot().tags[index].store(value, std::memory_order_relaxed);
+   }
+
+   static void SetLabel(const char* label) {
+      Slot().label.store(label, std::memory_order_relaxed);
+   }
+
+   static void SetName(const char* name, const char* role);
+   static void SetFreezable(bool freezable);
+   static void Clear();
+   static void Snapshot(std::vector<Record>& records);
+   static ThreadContextSlot& SlotAt(size_t index);
+   static void AfterFork();
+
+private:
+   struct Owner;
+   static ThreadContextSlot& Claim();
+
+   static thread_local ThreadContextSlot* mSlot;
+};
@@ -0,0 +1,122 @@
+
+#include "Watchdog.h"
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <new>
+#include <thread>
+#include "Death.h"
+
+namespace {
+   std::mutex gMonitorLock;
+   std::condition_variable gMonitorWake;
+   std::thread gMonitor;
+   bool gStopMonitor = false;
+   std::atomic<uint64_t> gTriggered{0};
+
+   /// What the monitor last saw in each slot, only touched by the monitor thread
+   struct Observation {
+      pid_t tid = 0;
+      uint64_t heartbeat = 0;
+      std::chrono::steady_clock::time_point changed;
+      bool reported = false;
+   };
+
+   void ReportHang(const ThreadContextSlot& slot, std::chrono::steady_clock::duration stalled) {
+      const uint32_t nameLength = slot.nameLength.load(std::memory_order_acquire);
+      const std::string name(slot.name, nameLength);
+      const char* role = slot.role.load(std::memory_order_relaxed);
+      char reason[256];
+      snprintf(reason, sizeof(reason), "HANG: thread %d '%s' role '%s' has no heartbeat for %lld ms, budget %llu ms",
+              static_cast<int>(slot.tid.load(std::memory_order_relaxed)), name.c_str(), role != nullptr ? role : "",
+              static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(stalled).count()),
+              static_cast<unsigned long long>(slot.budgetNs.load(std::memory_order_relaxed) / 1000000));
+      gTriggered.fetch_add(1, std::memory_order_relaxed);
+      Death::SyntheticFatal(__FILE__, __LINE__, __func__, reason);
+   }
+
+   void Monitor(std::chrono::milliseconds interval) {
+      std::vector<Observation> observations(ThreadContext::kMaxThreads);
+      std::unique_lock<std::mutex> lock(gMonitorLock);
+      while (!gMonitorWake.wait_for(lock, interval, [] { return gStopMonitor; })) {
+         const auto now = std::chrono::steady_clock::now();
+         for (size_t index = 0; index < ThreadContext::kMaxThreads; ++index) {
+            const ThreadContextSlot& slot = ThreadContext::SlotAt(index);
+            Observation& seen = observations[index];
+            const pid_t tid = slot.tid.load(std::memory_order_acquire);
+            const uint64_t budgetNs = slot.budgetNs.load(std::memory_order_relaxed);
+            const uint64_t heartbeat = slot.heartbeat.load(std::memory_order_relaxed);
+            if (tid <= 0 || budgetNs == 0 || tid != seen.tid || heartbeat != seen.heartbeat) {
+               seen = Observation{tid, heartbeat, now, false};
+               continue;
+            }
+            if (!seen.reported && now - seen.changed > std::chrono::nanoseconds(budgetNs)) {
+               seen.reported = true;
+               lock.unlock();
+               ReportHang(slot, now - seen.changed);
+               lock.lock();
+            }
+         }
+      }
+   }
+}
+
+/**
+ * Watch the calling thread, it must @ref Beat at least once per @param budget.
+ * Watching again resets the stall timer
+ */
+void Watchdog::Watch(std::chrono::milliseconds budget) {
+   auto& slot = ThreadContext::Slot();
+   Beat();
+   slot.budgetNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(budget).count(), std::memory_order_relaxed);
+}
+
+/// Stop watching the calling thread, e.g. before a blocking wait with no deadline
+void Watchdog::Unwatch() {
+   ThreadContext::Slot().budgetNs.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Start the monitor thread, sampling every @param interval. A stall is seen
+ * between budget and budget + interval after the last beat
+ * @return false if it is already running
+ */
+bool Watchdog::Start(std::chrono::milliseconds interval) {
+   std::lock_guard<std::mutex> glock(gMonitorLock);
+   if (gMonitor.joinable()) {
+      return false;
+   }
+   gStopMonitor = false;
+   gMonitor = std::thread(&Monitor, interval);
+   return true;
+}
+
+void Watchdog::Stop() {
+   std::thread monitor;
+   {
+      std::lock_guard<std::mutex> glock(gMonitorLock);
+      gStopMonitor = true;
+      monitor.swap(gMonitor);
+   }
+   gMonitorWake.notify_all();
+   if (monitor.joinable()) {
+      monitor.join();
+   }
+}
+
+/// @return hangs reported since the process started
+uint64_t Watchdog::Triggered() {
+   return gTriggered.load(std::memory_order_relaxed);
+}
+
+/**
+ * Child side of fork(), called by Death. The monitor thread was not copied and
+ * may have held the lock, the handle, lock and condition are replaced without
+ * joining or unlocking anything so that @ref Start works in the child
+ */
+void Watchdog::AfterFork() {
+   new (&gMonitor) std::thread();
+   new (&gMonitorLock) std::mutex();
+   new (&gMonitorWake) std::condition_variable();
+   gStopMonitor = false;
+}
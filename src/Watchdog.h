@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "ThreadContext.h"
+
+/**
+ * Hang detection that ends in the regular death path.
+ *
+ * A watched thread calls @ref Beat from its main loop, a relaxed store to its
+ * own cache line in the ThreadContext table. A monitor thread started with
+ * @ref Start samples the heartbeats and raises a synthetic fatal through
+ * Death::Received naming the first thread whose heartbeat has not moved
+ * within its budget. A thread is reported once per stall.
+ */
+class Watchdog {
+public:
+   static void Beat() {
+      auto& heartbeat = ThreadContext::Slot().heartbeat;
+      heartbeat.store(heartbeat.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   }
+
+   static void Watch(std::chrono::milliseconds budget);
+   static void Unwatch();
+   static bool Start(std::chrono::milliseconds interval);
+   static void Stop();
+   static uint64_t Triggered();
+   static void AfterFork();
+};
@@ -0,0 +1,138 @@
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <typeinfo>
+#include <unistd.h>
+#include <Death.h>
+#include "CrashRecord.h"
+
+namespace {
+   const std::string kRecordPath = "/tmp/DeathKnell.crashrecord.test";
+
+   std::string ReadFile(const std::string& path) {
+      std::ifstream file(path, std::ios::binary);
+      std::stringstream content;
+      content << file.rdbuf();
+      return content.str();
+   }
+
+   void NoOpCallback(const Death::DeathCallbackArg&) {
+   }
+}
+
+TEST(CrashRecordTest, WriterRoundTripsThroughJson) {
+   CrashRecord::Writer record;
+   record.Begin(CrashRecord::Breadcrumbs);
+   record.PutU32(1);
+   record.PutU64(42);
+   record.PutString("quote \" and\nnewline");
+   record.End();
+   ASSERT_TRUE(record.WriteToFile(kRecordPath));
+
+   std::ifstream input(kRecordPath, std::ios::binary);
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   EXPECT_NE(std::string::npos, json.str().find("\"type\":\"breadcrumbs\"")) << json.str();
+   EXPECT_NE(std::string::npos, json.str().find("\"realtime_ns\":42")) << json.str();
+   EXPECT_NE(std::string::npos, json.str().find("quote \\\" and\\nnewline")) << json.str();
+   unlink(kRecordPath.c_str());
+}
+
+TEST(CrashRecordTest, ReaderSkipsUnknownSections) {
+   CrashRecord::Writer record;
+   record.Begin(static_cast<CrashRecord::SectionType>(999));
+   record.PutU64(7);
+   record.Begin(CrashRecord::RawStack);
+   record.PutU32(1);
+   record.PutU64(0x1234);
+   record.End();
+   std::string buffer = record.Buffer();
+   CrashRecord::SectionHeader end{CrashRecord::End, 0, 0};
+   buffer.append(reinterpret_cast<const char*>(&end), sizeof(end));
+
+   std::istringstream input(buffer);
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   EXPECT_NE(std::string::npos, json.str().find("\"id\":999,\"length\":8")) << json.str();
+   EXPECT_NE(std::string::npos, json.str().find("\"0x1234\"")) << json.str();
+}
+
+TEST(CrashRecordTest, TruncatedRecordIsAnError) {
+   CrashRecord::Writer record;
+   record.Begin(CrashRecord::Fatal);
+   record.PutU32(6);
+   record.End();
+   std::istringstream input(record.Buffer().substr(0, record.Buffer().size() - 2));
+   std::ostringstream json;
+   std::string error;
+   EXPECT_FALSE(CrashRecord::ToJson(input, json, error));
+   EXPECT_FALSE(error.empty());
+}
+
+TEST(CrashRecordTest, DeathWritesCrashRecord) {
+   RaiiDeathCleanup cleanup;
+   unlink(kRecordPath.c_str());
+   Death::SetupExitHandler();
+   Death::SetCrashRecordPath(kRecordPath);
+   Death::RegisterDeathEvent(&NoOpCallback, "callback argument");
+   Death::LeaveBreadcrumb("before the fatal");
+   CHECK(false) << "crash record test";
+   Death::SetCrashRecordPath("");
+   EXPECT_TRUE(Death::WasKilled());
+
+   const std::string content = ReadFile(kRecordPath);
+   ASSERT_GT(content.size(), sizeof(CrashRecord::FileHeader));
+   std::istringstream input(content);
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   const std::string decoded = json.str();
+   EXPECT_NE(std::string::npos, decoded.find("crash record test")) << decoded;
+   EXPECT_NE(std::string::npos, decoded.find("\"status\":\"completed\",\"argument\":\"callback argument\"")) << decoded;
+   EXPECT_NE(std::string::npos, decoded.find("before the fatal")) << decoded;
+   EXPECT_NE(std::string::npos, decoded.find("\"type\":\"raw_stack\"")) << decoded;
+   EXPECT_NE(std::string::npos, decoded.find("\"stage\":\"total\"")) << decoded;
+   unlink(kRecordPath.c_str());
+}
+
+TEST(CrashRecordTest, ClearExitsDropsBreadcrumbs) {
+   RaiiDeathCleanup cleanup;
+   unlink(kRecordPath.c_str());
+   Death::LeaveBreadcrumb("from an earlier test");
+   Death::ClearExits();
+   Death::SetupExitHandler();
+   Death::SetCrashRecordPath(kRecordPath);
+   Death::LeaveBreadcrumb("current");
+   CHECK(false) << "breadcrumb reset test";
+   Death::SetCrashRecordPath("");
+
+   std::istringstream input(ReadFile(kRecordPath));
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   EXPECT_NE(std::string::npos, json.str().find("current")) << json.str();
+   EXPECT_EQ(std::string::npos, json.str().find("from an earlier test")) << json.str();
+   unlink(kRecordPath.c_str());
+}
+
+TEST(CrashRecordTest, ExceptionTypeIsDemangledByTheReader) {
+   CrashRecord::Writer record;
+   record.Begin(CrashRecord::Exception);
+   record.PutString(typeid(std::runtime_error).name());
+   record.PutString("disk full");
+   record.End();
+   std::string buffer = record.Buffer();
+   CrashRecord::SectionHeader end{CrashRecord::End, 0, 0};
+   buffer.append(reinterpret_cast<const char*>(&end), sizeof(end));
+
+   std::istringstream input(buffer);
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   EXPECT_NE(std::string::npos, json.str().find("\"exception_type\":\"std::runtime_error\"")) << json.str();
+   EXPECT_NE(std::string::npos, json.str().find("\"what\":\"disk full\"")) << json.str();
+}
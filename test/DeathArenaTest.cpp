@@ -0,0 +1,63 @@
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <vector>
+#include <Death.h>
+#include "DeathArena.h"
+
+TEST(DeathArenaTest, UnmappedArenaDoesNotAllocate) {
+   DeathArena arena;
+   EXPECT_EQ(nullptr, arena.Allocate(8));
+   EXPECT_EQ(nullptr, arena.Format("%d", 1));
+}
+
+TEST(DeathArenaTest, AllocationsAreAlignedBumps) {
+   DeathArena arena;
+   ASSERT_TRUE(arena.Map(4096));
+   auto first = static_cast<char*>(arena.Allocate(3, 1));
+   auto second = arena.Allocate(8, 64);
+   ASSERT_NE(nullptr, first);
+   ASSERT_NE(nullptr, second);
+   EXPECT_EQ(0, reinterpret_cast<uintptr_t>(second) % 64);
+   EXPECT_GT(static_cast<char*>(second), first);
+   EXPECT_EQ(nullptr, arena.Allocate(8192));
+
+   char* path = arena.Format("%s/%d.spill", "/tmp", 42);
+   ASSERT_NE(nullptr, path);
+   EXPECT_STREQ("/tmp/42.spill", path);
+
+   arena.Reset();
+   EXPECT_EQ(0, arena.Used());
+   EXPECT_EQ(first, arena.Allocate(1, 1));
+}
+
+TEST(DeathArenaTest, StandardContainersCanUseTheArena) {
+   DeathArena arena;
+   ASSERT_TRUE(arena.Map(4096));
+   std::vector<int, DeathArenaAllocator<int>> numbers{DeathArenaAllocator<int>(arena)};
+   numbers.reserve(16);
+   for (int i = 0; i < 16; ++i) {
+      numbers.push_back(i);
+   }
+   EXPECT_EQ(15, numbers.back());
+   EXPECT_GE(arena.Used(), 16 * sizeof(int));
+   EXPECT_THROW(numbers.reserve(10000), std::bad_alloc);
+}
+
+TEST(DeathArenaTest, CallbacksGetScratchMemoryAtDeath) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   ASSERT_TRUE(Death::SetupDeathArena(64 * 1024));
+   static std::string formatted;
+   auto formattingCallback = [](const Death::DeathCallbackArg& arg) {
+      const char* line = Death::Arena().Format("cleanup of %s", arg.c_str());
+      formatted = (line != nullptr) ? line : "";
+   };
+   Death::RegisterDeathEvent(formattingCallback, "journal");
+   CHECK(false);
+   EXPECT_EQ("cleanup of journal", formatted);
+   EXPECT_GT(Death::Arena().Used(), 0);
+   Death::ClearExits();
+   EXPECT_EQ(0, Death::Arena().Used());
+   Death::SetupDeathArena(0);
+}
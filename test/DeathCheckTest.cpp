@@ -0,0 +1,92 @@
+
+#include <gtest/gtest.h>
+#include <Death.h>
+#include "DeathCheck.h"
+
+TEST(DeathCheckTest, PassingCheckDoesNotDie) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   int value = 1;
+   DK_CHECK(value == 1);
+   DK_CHECK_MSG(value > 0, "value was %d", value);
+   DK_CHECK_EQ(value, 1);
+   DK_CHECK_LT(value, 2);
+   EXPECT_FALSE(Death::WasKilled());
+}
+
+TEST(DeathCheckTest, FailedCheckRoutesToDeath) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   int value = 1;
+   DK_CHECK(value == 2);
+   EXPECT_TRUE(Death::WasKilled());
+   EXPECT_NE(std::string::npos, Death::Message().find("DK_CHECK(value == 2) failed")) << Death::Message();
+   EXPECT_NE(std::string::npos, Death::Message().find("DeathCheckTest.cpp")) << Death::Message();
+}
+
+TEST(DeathCheckTest, FailedCheckMessageIsFormatted) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   DK_CHECK_MSG(false, "file %s, code %d", "journal", 42);
+   EXPECT_TRUE(Death::WasKilled());
+   EXPECT_NE(std::string::npos, Death::Message().find("file journal, code 42")) << Death::Message();
+}
+
+TEST(DeathCheckTest, FailedComparisonShowsBothValues) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   int evaluated = 0;
+   auto next = [&]() { return ++evaluated; };
+   DK_CHECK_GE(next(), 5);
+   EXPECT_EQ(1, evaluated);
+   EXPECT_TRUE(Death::WasKilled());
+   EXPECT_NE(std::string::npos, Death::Message().find("next() >= 5) failed (1 vs. 5)")) << Death::Message();
+}
+
+namespace {
+   int gSampledEvaluations = 0;
+
+   bool CountedInvariant(bool holds) {
+      ++gSampledEvaluations;
+      return holds;
+   }
+
+   void SampledSiteUnderTest(bool holds) {
+      DK_CHECK_SAMPLED(10, CountedInvariant(holds));
+   }
+}
+
+TEST(DeathCheckTest, SampledCheckEvaluatesOneInRate) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   gSampledEvaluations = 0;
+   for (int i = 0; i < 100; ++i) {
+      SampledSiteUnderTest(true);
+   }
+   EXPECT_EQ(10, gSampledEvaluations);
+   EXPECT_FALSE(Death::WasKilled());
+}
+
+TEST(DeathCheckTest, SampledCheckPeriodChangesAtRuntime) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   SampledSiteUnderTest(true); // make sure the site is registered
+   EXPECT_EQ(1, SampledCheck::SetPeriod("DeathCheckTest.cpp", 0, 1));
+   for (int i = 0; i < 20; ++i) {
+      SampledSiteUnderTest(true);
+   }
+   gSampledEvaluations = 0;
+   for (int i = 0; i < 20; ++i) {
+      SampledSiteUnderTest(true);
+   }
+   EXPECT_EQ(20, gSampledEvaluations);
+
+   SampledSiteUnderTest(false);
+   EXPECT_TRUE(Death::WasKilled());
+   EXPECT_NE(std::string::npos, Death::Message().find("DK_CHECK(CountedInvariant(holds)) failed")) << Death::Message();
+
+   const auto sites = SampledCheck::Snapshot();
+   ASSERT_EQ(1, sites.size());
+   EXPECT_EQ(1, sites[0].period);
+   SampledCheck::SetPeriod("DeathCheckTest.cpp", 0, 10);
+}
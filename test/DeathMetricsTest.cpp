@@ -0,0 +1,60 @@
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <Death.h>
+#include "DeathMetrics.h"
+
+namespace {
+   void NoOpCallback(const Death::DeathCallbackArg&) {
+   }
+
+   struct RaiiUnpublish {
+      ~RaiiUnpublish() {
+         DeathMetrics::Unpublish();
+      }
+   };
+}
+
+TEST(DeathMetricsTest, RegistryActivityIsCounted) {
+   RaiiDeathCleanup cleanup;
+   Death::ClearExits();
+   auto& metrics = DeathMetrics::Block();
+   const uint64_t registrations = metrics.registrations.load();
+   const uint64_t clearExits = metrics.clearExits.load();
+   const uint64_t simulations = metrics.simulations.load();
+
+   Death::RegisterDeathEvent(&NoOpCallback, "one");
+   Death::RegisterDeathEvent(&NoOpCallback, "two", Death::kDryRunCapable);
+   EXPECT_EQ(2, metrics.registeredHooks.load());
+   EXPECT_EQ(registrations + 2, metrics.registrations.load());
+
+   Death::Simulate();
+   EXPECT_EQ(simulations + 1, metrics.simulations.load());
+   EXPECT_GE(metrics.maxSimulationNs.load(), metrics.lastSimulationNs.load());
+
+   Death::ClearExits();
+   EXPECT_EQ(0, metrics.registeredHooks.load());
+   EXPECT_EQ(clearExits + 1, metrics.clearExits.load());
+}
+
+TEST(DeathMetricsTest, PublishedBlockIsReadableThroughSharedMemory) {
+   RaiiDeathCleanup cleanup;
+   RaiiUnpublish unpublish;
+   Death::ClearExits();
+   const std::string segment = "/deathknell.test." + std::to_string(getpid());
+   ASSERT_TRUE(DeathMetrics::Publish(segment));
+   EXPECT_EQ(segment, DeathMetrics::PublishedName());
+
+   const DeathMetricsBlock* monitor = DeathMetrics::Attach(segment);
+   ASSERT_NE(nullptr, monitor);
+   EXPECT_EQ(static_cast<uint32_t>(getpid()), monitor->pid);
+   const uint64_t registrations = monitor->registrations.load();
+   Death::RegisterDeathEvent(&NoOpCallback, "seen by the monitor");
+   EXPECT_EQ(registrations + 1, monitor->registrations.load());
+   EXPECT_EQ(1, monitor->registeredHooks.load());
+   DeathMetrics::Detach(monitor);
+
+   DeathMetrics::Unpublish();
+   EXPECT_EQ(nullptr, DeathMetrics::Attach(segment));
+   EXPECT_EQ(registrations + 1, DeathMetrics::Block().registrations.load());
+}
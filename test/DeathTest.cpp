@@ -5,6 +5,18 @@
 #include <Death.h>
 #include <FileIO.h>
 #include <cassert>
+#include <limits>
+#include <new>
+#include "CrashRecord.h"
+#include "DeathMetrics.h"
+#include "ThreadContext.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 bool DeathTest::ranEcho(false);
 std::vector<Death::DeathCallbackArg> DeathTest::stringsEchoed;
@@ -230,3 +242,326 @@ TEST(DeathTest, DISABLED_VerifyReceiveSignalAndExitForReal) {
 }
 
 
+
+TEST(DeathTest, TimingsCoverEveryStage) {
+   RaiiDeathCleanup cleanup;
+   const std::string recordPath = "/tmp/DeathKnell.timings.test";
+   unlink(recordPath.c_str());
+   Death::SetupExitHandler();
+   Death::SetCrashRecordPath(recordPath);
+   Death::RegisterDeathEvent(&DeathTest::EchoTheString, "first");
+   Death::RegisterDeathEvent(&DeathTest::EchoTheString, "second");
+   CHECK(false);
+   Death::SetCrashRecordPath("");
+
+   const auto timings = Death::Timings();
+   std::vector<uint16_t> stages;
+   for (const auto& timing : timings) {
+      stages.push_back(timing.stage);
+      EXPECT_GE(timing.duration.count(), 0);
+   }
+   const std::vector<uint16_t> expected = {CrashRecord::StageLockAcquire, CrashRecord::StageMessageCapture,
+      CrashRecord::StageCallback, CrashRecord::StageCallback, CrashRecord::StageExit, CrashRecord::StageLogPush};
+   EXPECT_EQ(expected, stages);
+   ASSERT_EQ(expected.size(), timings.size());
+   EXPECT_EQ(0, timings[2].index);
+   EXPECT_EQ(1, timings[3].index);
+
+   // the record has every stage up to the exit, the push to the logger happens after it is written
+   std::ifstream file(recordPath, std::ios::binary);
+   std::stringstream content;
+   content << file.rdbuf();
+   std::istringstream input(content.str());
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   const std::string decoded = json.str();
+   for (const char* stage : {"lock_acquire", "message_capture", "callback", "exit", "total"}) {
+      EXPECT_NE(std::string::npos, decoded.find(std::string("\"stage\":\"") + stage + "\"")) << stage << decoded;
+   }
+   EXPECT_EQ(std::string::npos, decoded.find("\"stage\":\"log_push\"")) << decoded;
+   unlink(recordPath.c_str());
+}
+
+TEST(DeathTest, SimulateRunsOnlyDryRunCapableCallbacks) {
+   DeathTest::ranEcho = false;
+   DeathTest::stringsEchoed.clear();
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   static bool simulatingInCallback = false;
+   auto dryRunCallback = [](const Death::DeathCallbackArg& arg) {
+      simulatingInCallback = Death::IsSimulating();
+      DeathTest::EchoTheString(arg);
+   };
+   Death::RegisterDeathEvent(&DeathTest::EchoTheString, "not dry run capable");
+   Death::RegisterDeathEvent(dryRunCallback, "dry run", Death::kDryRunCapable);
+
+   const auto report = Death::Simulate();
+   EXPECT_FALSE(Death::WasKilled());
+   EXPECT_FALSE(Death::IsSimulating());
+   EXPECT_TRUE(simulatingInCallback);
+   ASSERT_EQ(1, DeathTest::stringsEchoed.size());
+   EXPECT_EQ("dry run", DeathTest::stringsEchoed[0]);
+
+   ASSERT_EQ(3, report.size());
+   EXPECT_EQ(CrashRecord::StageCallback, report[1].stage);
+   EXPECT_EQ(1, report[1].index);
+   EXPECT_EQ(CrashRecord::StageTotal, report[2].stage);
+   EXPECT_GE(report[2].duration, report[1].duration);
+}
+
+TEST(DeathTest, EmergencyReserveIsReleasedForCallbacks) {
+   RaiiDeathCleanup cleanup;
+   const size_t kReserve = 8 * 1024 * 1024;
+   Death::SetupExitHandler(kReserve);
+   static std::vector<char>* allocatedAtDeath = nullptr;
+   auto allocatingCallback = [](const Death::DeathCallbackArg&) {
+      allocatedAtDeath = new std::vector<char>(kReserve / 2, 'x');
+   };
+   Death::RegisterDeathEvent(allocatingCallback, "allocate");
+   CHECK(false);
+
+   ASSERT_NE(nullptr, allocatedAtDeath);
+   EXPECT_GE(Death::EmergencyReserveUsed(), kReserve / 4);
+   EXPECT_LE(Death::EmergencyReserveUsed(), kReserve);
+   delete allocatedAtDeath;
+   allocatedAtDeath = nullptr;
+   Death::SetupExitHandler(0);
+}
+
+TEST(DeathTest, AllocationFailureIsRoutedToDeath) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler(64 * 1024, Death::kHandleAllocationFailure);
+   const size_t impossible = std::numeric_limits<size_t>::max() / 2;
+   EXPECT_THROW(::operator delete(::operator new(impossible)), std::bad_alloc);
+   EXPECT_TRUE(Death::WasKilled());
+   EXPECT_NE(std::string::npos, Death::Message().find("Allocation failure")) << Death::Message();
+   EXPECT_EQ(nullptr, std::get_new_handler());
+   Death::SetupExitHandler(0);
+}
+
+TEST(DeathTest, AllocationFailureUnderTheRegistryLockDiesDirectly) {
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      alarm(10); // a self-deadlock shows up as SIGALRM
+      Death::SetupExitHandler(0, Death::kHandleAllocationFailure);
+      const std::string argument(64 * 1024 * 1024, 'x');
+      std::ifstream statm("/proc/self/statm");
+      size_t pages = 0;
+      statm >> pages;
+      const rlim_t available = pages * sysconf(_SC_PAGESIZE) + 16 * 1024 * 1024;
+      rlimit limit{available, available};
+      setrlimit(RLIMIT_AS, &limit);
+      // the copy of the argument is made while the registry lock is held
+      Death::RegisterDeathEvent(&DeathTest::EchoTheString, argument);
+      _exit(0);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   ASSERT_TRUE(WIFEXITED(status)) << status;
+   EXPECT_EQ(EXIT_FAILURE, WEXITSTATUS(status));
+}
+
+TEST(DeathTest, TerminateIsRecordedAndAborts) {
+   const std::string recordPath = "/tmp/DeathKnell.terminate.test";
+   unlink(recordPath.c_str());
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      alarm(10);
+      Death::SetupExitHandler(0, Death::kHandleTerminate);
+      Death::SetCrashRecordPath(recordPath);
+      try {
+         throw std::runtime_error("disk full");
+      } catch (...) {
+         std::terminate();
+      }
+      _exit(0);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   ASSERT_TRUE(WIFSIGNALED(status)) << status;
+   EXPECT_EQ(SIGABRT, WTERMSIG(status));
+
+   std::ifstream file(recordPath, std::ios::binary);
+   std::stringstream content;
+   content << file.rdbuf();
+   std::istringstream input(content.str());
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   EXPECT_NE(std::string::npos, json.str().find("\"exception_type\":\"std::runtime_error\"")) << json.str();
+   EXPECT_NE(std::string::npos, json.str().find("\"what\":\"disk full\"")) << json.str();
+   EXPECT_NE(std::string::npos, json.str().find("std::terminate called")) << json.str();
+   unlink(recordPath.c_str());
+}
+
+TEST(DeathTest, ForkedChildSkipsParentEvents) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   Death::RegisterDeathEvent(&DeathTest::EchoTheString, "parent only", Death::kDryRunCapable);
+   Death::RegisterDeathEvent(&DeathTest::EchoTheString, "inherited", Death::kDryRunCapable | Death::kInheritOnFork);
+
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      const Death::LatencyReport report = Death::Simulate();
+      const bool onlyInherited = report.size() == 3 && report[1].stage == CrashRecord::StageCallback &&
+              report[1].index == 1 && DeathMetrics::Block().registeredHooks.load() == 1;
+      _exit(onlyInherited ? 0 : 1);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   EXPECT_TRUE(WIFEXITED(status));
+   EXPECT_EQ(0, WEXITSTATUS(status));
+   EXPECT_EQ(4u, Death::Simulate().size());
+}
+
+TEST(DeathTest, CallbackCanFork) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   static int childStatus = -1;
+   auto forkingCallback = [](const Death::DeathCallbackArg&) {
+      const pid_t child = fork();
+      if (child == 0) {
+         _exit(0);
+      }
+      waitpid(child, &childStatus, 0);
+   };
+   Death::RegisterDeathEvent(forkingCallback, "fork");
+   CHECK(false) << "fork from a callback";
+   EXPECT_TRUE(WIFEXITED(childStatus));
+   EXPECT_EQ(0, WEXITSTATUS(childStatus));
+}
+
+TEST(DeathTest, ThreadEventsRunOnlyForTheFaultingThread) {
+   RaiiDeathCleanup cleanup;
+   DeathTest::stringsEchoed.clear();
+   Death::SetupExitHandler();
+   Death::RegisterDeathEvent(&DeathTest::EchoTheString, "global");
+   Death::RegisterThreadDeathEvent(&DeathTest::EchoTheString, "faulting thread");
+
+   std::promise<void> registered;
+   std::promise<void> release;
+   std::thread other([&] {
+      Death::RegisterThreadDeathEvent(&DeathTest::EchoTheString, "other thread");
+      registered.set_value();
+      release.get_future().wait();
+   });
+   registered.get_future().wait();
+   CHECK(false) << "thread hooks";
+   release.set_value();
+   other.join();
+
+   ASSERT_EQ(2u, DeathTest::stringsEchoed.size());
+   EXPECT_EQ("faulting thread", DeathTest::stringsEchoed[0]);
+   EXPECT_EQ("global", DeathTest::stringsEchoed[1]);
+   const auto timings = Death::Timings();
+   ASSERT_GT(timings.size(), 3u);
+   EXPECT_EQ(CrashRecord::StageThreadCallback, timings[2].stage);
+   EXPECT_EQ(0, timings[2].index);
+   EXPECT_EQ(CrashRecord::StageCallback, timings[3].stage);
+}
+
+namespace {
+   std::atomic<size_t> gPausedDuringCallback{0};
+   std::atomic<int> gCpusDuringCallback{0};
+
+   void WaitForPausedWorker(const Death::DeathCallbackArg&) {
+      for (int attempt = 0; attempt < 1000 && Death::PausedThreads() == 0; ++attempt) {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      gPausedDuringCallback = Death::PausedThreads();
+      Death::Safepoint(); // the dying thread never stops at its own safepoint
+      cpu_set_t affinity;
+      sched_getaffinity(0, sizeof(affinity), &affinity);
+      gCpusDuringCallback = CPU_COUNT(&affinity);
+   }
+}
+
+TEST(DeathTest, DeathSchedulingRejectsCpuOutsideTheSet) {
+   EXPECT_FALSE(Death::SetupDeathScheduling(false, CPU_SETSIZE));
+   EXPECT_TRUE(Death::SetupDeathScheduling(false));
+}
+
+TEST(DeathTest, DeathSchedulingPinsAndPausesWorkers) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   Death::SetupDeathScheduling(true, 0, true);
+   Death::RegisterDeathEvent(&WaitForPausedWorker, "");
+
+   std::atomic<bool> stop{false};
+   std::thread worker([&] {
+      while (!stop) {
+         Death::Safepoint();
+         std::this_thread::yield();
+      }
+   });
+   cpu_set_t before;
+   sched_getaffinity(0, sizeof(before), &before);
+   CHECK(false) << "scheduling test";
+   stop = true;
+   worker.join();
+   Death::SetupDeathScheduling(false);
+
+   EXPECT_EQ(1u, gPausedDuringCallback.load());
+   EXPECT_EQ(1, gCpusDuringCallback.load());
+   EXPECT_FALSE(Death::PauseRequested());
+   cpu_set_t after;
+   sched_getaffinity(0, sizeof(after), &after);
+   EXPECT_TRUE(CPU_EQUAL(&before, &after));
+}
+
+namespace {
+   std::atomic<uint64_t> gFreezeWork{0};
+   std::atomic<bool> gWorkStoodStill{false};
+
+   void CheckWorkerIsFrozen(const Death::DeathCallbackArg&) {
+      const uint64_t before = gFreezeWork.load();
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      gWorkStoodStill = (before == gFreezeWork.load()) && Death::PausedThreads() == 1;
+   }
+
+   void FreezeWhileWorking(Death::FreezeMode mode, bool safepoints) {
+      RaiiDeathCleanup cleanup;
+      Death::SetupExitHandler();
+      ASSERT_TRUE(Death::SetupDeathFreeze(mode, std::chrono::milliseconds(1000)));
+      Death::RegisterDeathEvent(&CheckWorkerIsFrozen, "");
+      gWorkStoodStill = false;
+
+      std::atomic<bool> started{false};
+      std::atomic<bool> stop{false};
+      std::thread worker([&] {
+         ThreadContext::SetFreezable(true);
+         started = true;
+         while (!stop) {
+            if (safepoints) {
+               Death::Safepoint();
+            }
+            gFreezeWork.fetch_add(1);
+         }
+         ThreadContext::SetFreezable(false);
+      });
+      while (!started) {
+         std::this_thread::yield();
+      }
+      CHECK(false) << "freeze test";
+      stop = true;
+      worker.join();
+      Death::SetupDeathFreeze(Death::kNoFreeze);
+
+      EXPECT_TRUE(gWorkStoodStill.load());
+      const auto timings = Death::Timings();
+      ASSERT_GT(timings.size(), 3u);
+      EXPECT_EQ(CrashRecord::StageFreeze, timings[2].stage);
+   }
+}
+
+TEST(DeathTest, FreezeStopsThreadsAtSafepoints) {
+   FreezeWhileWorking(Death::kFreezeAtSafepoint, true);
+}
+
+TEST(DeathTest, FreezeStopsThreadsBySignal) {
+   FreezeWhileWorking(Death::kFreezeBySignal, false);
+}
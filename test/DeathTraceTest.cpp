@@ -0,0 +1,101 @@
+
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <Death.h>
+#include "DeathTrace.h"
+#include "DurableRegions.h"
+
+namespace {
+   const std::string kTracePath = "/tmp/DeathKnell.trace.test.json";
+
+   void DryRunCallback(const Death::DeathCallbackArg&) {
+   }
+
+   std::string ReadTrace() {
+      std::ifstream file(kTracePath);
+      std::stringstream content;
+      content << file.rdbuf();
+      return content.str();
+   }
+
+   size_t Count(const std::string& text, const std::string& what) {
+      size_t count = 0;
+      for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) {
+         ++count;
+      }
+      return count;
+   }
+
+   struct RaiiTraceDisable {
+      ~RaiiTraceDisable() {
+         DeathTrace::Disable();
+         unlink(kTracePath.c_str());
+      }
+   };
+}
+
+TEST(DeathTraceTest, DeathSequenceIsWrittenAsChromeTrace) {
+   RaiiDeathCleanup cleanup;
+   RaiiTraceDisable disable;
+   Death::SetupExitHandler();
+   DeathTrace::Enable(kTracePath, 64);
+   Death::RegisterDeathEvent(&DryRunCallback, "one");
+   Death::RegisterDeathEvent(&DryRunCallback, "two");
+   CHECK(false);
+
+   const std::string trace = ReadTrace();
+   EXPECT_EQ(0, trace.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[")) << trace;
+   EXPECT_EQ(2, Count(trace, "\"name\":\"callback\",\"cat\":\"death\",\"ph\":\"X\"")) << trace;
+   EXPECT_EQ(1, Count(trace, "\"name\":\"lock_acquire\"")) << trace;
+   EXPECT_EQ(1, Count(trace, "\"name\":\"total\"")) << trace;
+   EXPECT_EQ(trace.size() - 4, trace.rfind("\n]}\n")) << trace;
+}
+
+TEST(DeathTraceTest, ThreadHooksAndDurableFlushesAreTraced) {
+   RaiiDeathCleanup cleanup;
+   RaiiTraceDisable disable;
+   Death::SetupExitHandler();
+   DeathTrace::Enable(kTracePath, 64);
+   Death::RegisterThreadDeathEvent(&DryRunCallback, "hook");
+   const std::string path = "/tmp/DeathKnell.trace.durable.test";
+   const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   ASSERT_GE(fd, 0);
+   const int first = DurableRegions::RegisterFile(fd, "first");
+   const int second = DurableRegions::RegisterFile(fd, "second");
+   ASSERT_TRUE(DurableRegions::Start(2));
+   CHECK(false);
+   DurableRegions::Stop();
+   DurableRegions::Unregister(first);
+   DurableRegions::Unregister(second);
+   close(fd);
+   unlink(path.c_str());
+   Death::ClearThreadExits();
+
+   const std::string trace = ReadTrace();
+   EXPECT_EQ(1, Count(trace, "\"name\":\"thread_callback\"")) << trace;
+   // one event per region from whichever thread flushed it, and the wait at the end
+   EXPECT_EQ(3, Count(trace, "\"name\":\"durable_flush\"")) << trace;
+}
+
+TEST(DeathTraceTest, SimulationIsRecordedUntilFlush) {
+   RaiiDeathCleanup cleanup;
+   RaiiTraceDisable disable;
+   DeathTrace::Enable(kTracePath, 3);
+   Death::RegisterDeathEvent(&DryRunCallback, "dry", Death::kDryRunCapable);
+   Death::Simulate();
+   Death::Simulate();
+   EXPECT_EQ(1, DeathTrace::Dropped());
+   ASSERT_TRUE(DeathTrace::Flush());
+
+   const std::string trace = ReadTrace();
+   EXPECT_EQ(3, Count(trace, "\"cat\":\"simulation\"")) << trace;
+}
+
+TEST(DeathTraceTest, DisabledTraceRecordsNothing) {
+   EXPECT_FALSE(DeathTrace::IsEnabled());
+   DeathTrace::Record(DeathTrace::kDeath, 0, 0, 0, 0, 0);
+   EXPECT_FALSE(DeathTrace::Flush());
+}
@@ -0,0 +1,123 @@
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <Death.h>
+#include "CrashRecord.h"
+#include "DurableRegions.h"
+
+namespace {
+   const std::string kJournalPath = "/tmp/DeathKnell.durable.test";
+   const std::string kRecordPath = "/tmp/DeathKnell.durable.crashrecord.test";
+
+   bool gFlushedDuringCallbacks = false;
+
+   /// the workers flush while the callbacks run, the dying thread has not reached Finish yet
+   void WaitForWorkers(const Death::DeathCallbackArg&) {
+      for (int attempt = 0; attempt < 1000 && !gFlushedDuringCallbacks; ++attempt) {
+         const auto results = DurableRegions::Results();
+         gFlushedDuringCallbacks = !results.empty() && results[0].status == DurableRegions::kDone;
+         usleep(1000);
+      }
+   }
+}
+
+TEST(DurableRegionsTest, FlushReportsEveryRegion) {
+   DurableRegions::Clear();
+   const int fd = open(kJournalPath.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+   ASSERT_GE(fd, 0);
+   ASSERT_EQ(0, ftruncate(fd, 4096));
+   void* mapping = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ASSERT_NE(MAP_FAILED, mapping);
+   memcpy(mapping, "journal", 7);
+
+   EXPECT_EQ(0, DurableRegions::RegisterMapping(mapping, 4096, "journal"));
+   EXPECT_EQ(1, DurableRegions::RegisterFile(fd, "journal fd"));
+   EXPECT_EQ(2, DurableRegions::RegisterFile(-1, "closed fd"));
+   ASSERT_TRUE(DurableRegions::Start(2));
+   EXPECT_TRUE(DurableRegions::Flush());
+   DurableRegions::Stop();
+
+   const auto results = DurableRegions::Results();
+   ASSERT_EQ(3u, results.size());
+   EXPECT_EQ(DurableRegions::kDone, results[0].status);
+   EXPECT_EQ(DurableRegions::kMapping, results[0].kind);
+   EXPECT_EQ(DurableRegions::kDone, results[1].status);
+   EXPECT_EQ(DurableRegions::kFailed, results[2].status);
+   EXPECT_EQ(EBADF, results[2].error);
+   EXPECT_EQ("closed fd", results[2].name);
+
+   DurableRegions::Clear();
+   munmap(mapping, 4096);
+   close(fd);
+   unlink(kJournalPath.c_str());
+}
+
+TEST(DurableRegionsTest, DeathFlushesIntoTheCrashRecord) {
+   RaiiDeathCleanup cleanup;
+   DurableRegions::Clear();
+   unlink(kRecordPath.c_str());
+   const int fd = open(kJournalPath.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+   ASSERT_GE(fd, 0);
+   DurableRegions::RegisterFile(fd, "journal fd");
+   ASSERT_TRUE(DurableRegions::Start(2));
+   gFlushedDuringCallbacks = false;
+   Death::SetupExitHandler();
+   Death::SetCrashRecordPath(kRecordPath);
+   Death::RegisterDeathEvent(&WaitForWorkers, "");
+   CHECK(false) << "durable regions test";
+   Death::SetCrashRecordPath("");
+   DurableRegions::Stop();
+   DurableRegions::Clear();
+   EXPECT_TRUE(gFlushedDuringCallbacks);
+   close(fd);
+   unlink(kJournalPath.c_str());
+
+   std::ifstream input(kRecordPath, std::ios::binary);
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   EXPECT_NE(std::string::npos, json.str().find("{\"name\":\"journal fd\",\"kind\":\"file\",\"status\":\"done\",\"errno\":0")) << json.str();
+   EXPECT_NE(std::string::npos, json.str().find("\"stage\":\"durable_flush\"")) << json.str();
+   unlink(kRecordPath.c_str());
+}
+
+TEST(DurableRegionsTest, NothingStartsAfterTheDeadline) {
+   DurableRegions::Clear();
+   const int fd = open(kJournalPath.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+   ASSERT_GE(fd, 0);
+   DurableRegions::RegisterFile(fd, "journal fd");
+   DurableRegions::SetDeadline(std::chrono::milliseconds(0));
+   EXPECT_FALSE(DurableRegions::Flush());
+   DurableRegions::SetDeadline(std::chrono::milliseconds(1000));
+
+   const auto results = DurableRegions::Results();
+   ASSERT_EQ(1u, results.size());
+   EXPECT_EQ(DurableRegions::kPending, results[0].status);
+   DurableRegions::Clear();
+   close(fd);
+   unlink(kJournalPath.c_str());
+}
+
+TEST(DurableRegionsTest, WorkersRestartInForkedChild) {
+   Death::Instance();  // registers the fork handlers
+   ASSERT_TRUE(DurableRegions::Start(2));
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      alarm(10);
+      const bool started = DurableRegions::Start(2);
+      DurableRegions::Stop();
+      _exit(started ? 0 : 1);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   DurableRegions::Stop();
+   ASSERT_TRUE(WIFEXITED(status)) << status;
+   EXPECT_EQ(0, WEXITSTATUS(status));
+}
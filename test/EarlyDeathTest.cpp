@@ -0,0 +1,44 @@
+
+#include <gtest/gtest.h>
+#include <string>
+#include <Death.h>
+#include "EarlyDeath.h"
+
+namespace {
+   std::string gEarlyArguments;
+
+   void RecordEarly(const char* argument) {
+      gEarlyArguments.append(argument);
+   }
+
+   /// Registered from a static initializer, before main
+   const bool gRegisteredBeforeMain = EarlyDeath::Register(&RecordEarly, "static");
+}
+
+TEST(EarlyDeathTest, RegistrationWorksBeforeMain) {
+   EXPECT_TRUE(gRegisteredBeforeMain);
+}
+
+TEST(EarlyDeathTest, EventsRunOnceAtDeath) {
+   RaiiDeathCleanup cleanup;
+   EarlyDeath::Clear();
+   EXPECT_TRUE(EarlyDeath::Register(&RecordEarly, "first"));
+   EXPECT_TRUE(EarlyDeath::Register(&RecordEarly, "+second"));
+   EXPECT_EQ(2u, EarlyDeath::Registered());
+   gEarlyArguments.clear();
+   Death::SetupExitHandler();
+   CHECK(false) << "early death test";
+   EXPECT_TRUE(Death::WasKilled());
+   EXPECT_EQ("first+second", gEarlyArguments);
+   EXPECT_EQ(0u, EarlyDeath::Registered());
+}
+
+TEST(EarlyDeathTest, RegistryIsBounded) {
+   EarlyDeath::Clear();
+   for (size_t i = 0; i < EarlyDeath::kMaxEvents; ++i) {
+      EXPECT_TRUE(EarlyDeath::Register(&RecordEarly, ""));
+   }
+   EXPECT_FALSE(EarlyDeath::Register(&RecordEarly, ""));
+   EarlyDeath::Clear();
+   EXPECT_EQ(0u, EarlyDeath::Registered());
+}
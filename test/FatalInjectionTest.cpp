@@ -0,0 +1,62 @@
+
+#include <gtest/gtest.h>
+#include <Death.h>
+#include "FatalInjection.h"
+
+namespace {
+   const uint32_t kTestSite = 7;
+
+   struct RaiiInjectionReset {
+      ~RaiiInjectionReset() {
+         FatalInjection::Reset();
+      }
+   };
+}
+
+TEST(FatalInjectionTest, DisarmedSiteNeverFires) {
+   RaiiDeathCleanup cleanup;
+   RaiiInjectionReset reset;
+   Death::SetupExitHandler();
+   FatalInjection::Configure(kTestSite, 1.0, 1000);
+   for (int i = 0; i < 100; ++i) {
+      DK_INJECT_FATAL(kTestSite);
+   }
+   EXPECT_FALSE(Death::WasKilled());
+   EXPECT_EQ(0, FatalInjection::Fired(kTestSite));
+}
+
+TEST(FatalInjectionTest, ArmedSiteRaisesFatalThroughDeath) {
+   RaiiDeathCleanup cleanup;
+   RaiiInjectionReset reset;
+   Death::SetupExitHandler();
+   FatalInjection::Configure(kTestSite, 1.0, 1000);
+   FatalInjection::Arm();
+   DK_INJECT_FATAL(kTestSite);
+   EXPECT_TRUE(Death::WasKilled());
+   EXPECT_NE(std::string::npos, Death::Message().find("Injected fatal at site 7")) << Death::Message();
+   EXPECT_EQ(1, FatalInjection::Fired(kTestSite));
+}
+
+TEST(FatalInjectionTest, UnconfiguredSiteDoesNotFire) {
+   RaiiDeathCleanup cleanup;
+   RaiiInjectionReset reset;
+   Death::SetupExitHandler();
+   FatalInjection::Arm();
+   DK_INJECT_FATAL(kTestSite + 1);
+   DK_INJECT_FATAL(FatalInjection::kMaxSites);
+   EXPECT_FALSE(Death::WasKilled());
+}
+
+TEST(FatalInjectionTest, RateLimitCapsFires) {
+   RaiiDeathCleanup cleanup;
+   RaiiInjectionReset reset;
+   Death::SetupExitHandler();
+   FatalInjection::Configure(kTestSite, 1.0, 2);
+   FatalInjection::Arm();
+   for (int i = 0; i < 50; ++i) {
+      DK_INJECT_FATAL(kTestSite);
+   }
+   // a second boundary may open one more window while the loop runs
+   EXPECT_GE(FatalInjection::Fired(kTestSite), 2);
+   EXPECT_LE(FatalInjection::Fired(kTestSite), 4);
+}
@@ -0,0 +1,70 @@
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "MemoryGuard.h"
+
+namespace {
+   std::atomic<int> gShedCalls{0};
+
+   void Shed(const Death::DeathCallbackArg&) {
+      gShedCalls++;
+   }
+
+   template<typename Predicate>
+   bool WaitFor(Predicate predicate) {
+      for (int attempt = 0; attempt < 2000 && !predicate(); ++attempt) {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      return predicate();
+   }
+}
+
+TEST(MemoryGuardTest, ShedsBelowTheDeathThreshold) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   gShedCalls = 0;
+   MemoryGuard::RegisterShedEvent(&Shed, "");
+   ASSERT_TRUE(MemoryGuard::Start(1ull << 40, std::chrono::milliseconds(1), 0.0000001, 1.0));
+   EXPECT_GT(MemoryGuard::Usage(), 0u);
+   EXPECT_FALSE(MemoryGuard::UsingCgroup());
+   EXPECT_TRUE(WaitFor([] { return gShedCalls > 0; }));
+   std::this_thread::sleep_for(std::chrono::milliseconds(10));
+   MemoryGuard::Stop();
+   MemoryGuard::ClearShedEvents();
+   EXPECT_EQ(1, gShedCalls.load());
+   EXPECT_FALSE(Death::WasKilled());
+}
+
+TEST(MemoryGuardTest, CrossingTheLimitRaisesAFatal) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   ASSERT_TRUE(MemoryGuard::Start(4096, std::chrono::milliseconds(1)));
+   EXPECT_TRUE(WaitFor([] { return Death::WasKilled(); }));
+   MemoryGuard::Stop();
+   EXPECT_NE(std::string::npos, Death::Message().find("MEMORY: rss usage")) << Death::Message();
+   EXPECT_EQ(0u, MemoryGuard::Usage());
+}
+
+TEST(MemoryGuardTest, MonitorRestartsInForkedChild) {
+   Death::Instance();  // registers the fork handlers
+   ASSERT_TRUE(MemoryGuard::Start(1ull << 40, std::chrono::milliseconds(1)));
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      alarm(10);
+      const bool stopped = MemoryGuard::Usage() == 0;
+      const bool started = MemoryGuard::Start(1ull << 40, std::chrono::milliseconds(1));
+      const bool sampling = MemoryGuard::Usage() > 0;
+      MemoryGuard::Stop();
+      _exit(stopped && started && sampling ? 0 : 1);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   EXPECT_GT(MemoryGuard::Usage(), 0u);
+   MemoryGuard::Stop();
+   ASSERT_TRUE(WIFEXITED(status)) << status;
+   EXPECT_EQ(0, WEXITSTATUS(status));
+}
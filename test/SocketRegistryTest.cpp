@@ -0,0 +1,104 @@
+
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <Death.h>
+#include "SocketRegistry.h"
+
+namespace {
+   const std::string kPortFile = "/tmp/DeathKnell.ports.test";
+
+   sockaddr_in Loopback(uint16_t port) {
+      sockaddr_in address{};
+      address.sin_family = AF_INET;
+      address.sin_port = htons(port);
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      return address;
+   }
+
+   uint16_t PortOf(int fd) {
+      sockaddr_in address{};
+      socklen_t length = sizeof(address);
+      getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+      return ntohs(address.sin_port);
+   }
+}
+
+TEST(SocketRegistryTest, DeathResetsConnectionsAndRecordsPorts) {
+   RaiiDeathCleanup cleanup;
+   SocketRegistry::Clear();
+   const int listener = socket(AF_INET, SOCK_STREAM, 0);
+   sockaddr_in address = Loopback(0);
+   ASSERT_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)));
+   ASSERT_EQ(0, listen(listener, 1));
+   const uint16_t port = PortOf(listener);
+
+   const int client = socket(AF_INET, SOCK_STREAM, 0);
+   address = Loopback(port);
+   ASSERT_EQ(0, connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)));
+   const int accepted = accept(listener, nullptr, nullptr);
+   ASSERT_GE(accepted, 0);
+
+   EXPECT_GE(SocketRegistry::Register(listener), 0);
+   EXPECT_GE(SocketRegistry::Register(accepted), 0);
+   ASSERT_TRUE(SocketRegistry::SetPortFile(kPortFile));
+   Death::SetupExitHandler();
+   CHECK(false) << "socket registry test";
+   SocketRegistry::SetPortFile("");
+
+   EXPECT_EQ(-1, fcntl(listener, F_GETFD));
+   EXPECT_EQ(-1, fcntl(accepted, F_GETFD));
+   char byte = 0;
+   EXPECT_EQ(-1, read(client, &byte, 1));
+   EXPECT_EQ(ECONNRESET, errno);
+   close(client);
+   ASSERT_EQ(2u, SocketRegistry::LastClosed().size());
+   EXPECT_EQ(port, SocketRegistry::LastClosed()[0].port);
+
+   const auto ports = SocketRegistry::PortsToRebind(kPortFile);
+   ASSERT_EQ(2u, ports.size());
+   EXPECT_EQ(port, ports[0]);
+   const int replacement = socket(AF_INET, SOCK_STREAM, 0);
+   EXPECT_TRUE(SocketRegistry::PrepareRebind(replacement));
+   address = Loopback(port);
+   EXPECT_EQ(0, bind(replacement, reinterpret_cast<sockaddr*>(&address), sizeof(address)));
+   close(replacement);
+   unlink(kPortFile.c_str());
+}
+
+TEST(SocketRegistryTest, ForkedChildLeavesParentSocketsAlone) {
+   SocketRegistry::Clear();
+   const int listener = socket(AF_INET, SOCK_STREAM, 0);
+   sockaddr_in address = Loopback(0);
+   ASSERT_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)));
+   ASSERT_EQ(0, listen(listener, 1));
+   const int id = SocketRegistry::Register(listener);
+   ASSERT_GE(id, 0);
+   ASSERT_TRUE(SocketRegistry::SetPortFile(kPortFile));
+
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      _exit(SocketRegistry::AbortAll() == 0 ? 0 : 1);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   EXPECT_TRUE(WIFEXITED(status));
+   EXPECT_EQ(0, WEXITSTATUS(status));
+
+   linger option{};
+   socklen_t length = sizeof(option);
+   ASSERT_EQ(0, getsockopt(listener, SOL_SOCKET, SO_LINGER, &option, &length));
+   EXPECT_EQ(0, option.l_onoff);
+   EXPECT_TRUE(SocketRegistry::PortsToRebind(kPortFile).empty());
+
+   SocketRegistry::Unregister(id);
+   SocketRegistry::SetPortFile("");
+   close(listener);
+   unlink(kPortFile.c_str());
+}
@@ -0,0 +1,58 @@
+
+#include <gtest/gtest.h>
+#include <Death.h>
+#include "SoftFatal.h"
+
+namespace {
+   const SoftFatal::SiteSnapshot* FindSite(const std::vector<SoftFatal::SiteSnapshot>& sites, const std::string& expression) {
+      for (const auto& site : sites) {
+         if (site.expression == expression) {
+            return &site;
+         }
+      }
+      return nullptr;
+   }
+}
+
+TEST(SoftFatalTest, ViolationsAreCountedWithoutDying) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   int limit = 3;
+   for (int value = 0; value < 10; ++value) {
+      DK_SOFT_CHECK(value < limit);
+   }
+   EXPECT_FALSE(Death::WasKilled());
+
+   const auto sites = SoftFatal::Snapshot();
+   const auto site = FindSite(sites, "value < limit");
+   ASSERT_NE(nullptr, site);
+   EXPECT_EQ(7, site->violations);
+   EXPECT_EQ(SoftFatalSite::kKeptRecords, site->records.size());
+   EXPECT_NE(0, site->records[0].threadId);
+   EXPECT_NE(0, site->records[0].realtimeNs);
+}
+
+TEST(SoftFatalTest, SiteIsPromotedAboveItsRate) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   bool sessionValid = false;
+   // five violations, even split by a second boundary one window sees three
+   for (int i = 0; i < 5 && !Death::WasKilled(); ++i) {
+      DK_SOFT_CHECK_RATE(2, sessionValid);
+   }
+   EXPECT_TRUE(Death::WasKilled());
+   EXPECT_NE(std::string::npos, Death::Message().find("Soft fatal promoted: (sessionValid)")) << Death::Message();
+}
+
+TEST(SoftFatalTest, GlobalThresholdAppliesToPlainSites) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   EXPECT_EQ(0, SoftFatal::PromotionThreshold());
+   SoftFatal::SetPromotionThreshold(1);
+   bool healthy = false;
+   for (int i = 0; i < 3 && !Death::WasKilled(); ++i) {
+      DK_SOFT_CHECK(healthy);
+   }
+   SoftFatal::SetPromotionThreshold(0);
+   EXPECT_TRUE(Death::WasKilled());
+}
@@ -0,0 +1,174 @@
+
+#include <gtest/gtest.h>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <Death.h>
+#include "CrashRecord.h"
+#include "SpillQueues.h"
+
+namespace {
+   const std::string kSpillPath = "/tmp/DeathKnell.spill.test";
+   const std::string kRecordPath = "/tmp/DeathKnell.spill.crashrecord.test";
+
+   /// A queue of strings and how far the cursor has got
+   struct TestQueue {
+      std::deque<std::string> events;
+      size_t position = 0;
+   };
+
+   size_t NextEvents(void* context, iovec* vectors, size_t maxEvents) {
+      auto& queue = *static_cast<TestQueue*>(context);
+      size_t count = 0;
+      for (; count < maxEvents && queue.position < queue.events.size(); ++count, ++queue.position) {
+         auto& event = queue.events[queue.position];
+         vectors[count] = {&event[0], event.size()};
+      }
+      return count;
+   }
+
+   size_t FailingCursor(void* context, iovec* vectors, size_t maxEvents) {
+      auto& calls = *static_cast<int*>(context);
+      if (++calls == 1) {
+         CHECK(false) << "fatal in a queue cursor";
+      }
+      return 0;
+   }
+
+   /// fills the batch but claims one event more than it was given room for
+   size_t OvercountingCursor(void* context, iovec* vectors, size_t maxEvents) {
+      auto& event = *static_cast<std::string*>(context);
+      for (size_t count = 0; count < maxEvents; ++count) {
+         vectors[count] = {&event[0], event.size()};
+      }
+      return maxEvents + 1;
+   }
+}
+
+TEST(SpillQueuesTest, DeathSpillsQueuesForReplay) {
+   RaiiDeathCleanup cleanup;
+   SpillQueues::Clear();
+   unlink(kRecordPath.c_str());
+   ASSERT_TRUE(SpillQueues::Prepare(kSpillPath, 1 << 20));
+
+   TestQueue orders;
+   for (int event = 0; event < 1200; ++event) {
+      orders.events.push_back("order-" + std::to_string(event));
+   }
+   TestQueue audit;
+   audit.events.push_back("audit");
+   ASSERT_GE(SpillQueues::Register(7, &NextEvents, &orders), 0);
+   ASSERT_GE(SpillQueues::Register(9, &NextEvents, &audit), 0);
+
+   Death::SetupExitHandler();
+   Death::SetCrashRecordPath(kRecordPath);
+   CHECK(false) << "spill test";
+   Death::SetCrashRecordPath("");
+   SpillQueues::Clear();
+
+   const auto spill = SpillQueues::LastSpill();
+   EXPECT_EQ(2u, spill.queues);
+   EXPECT_EQ(1201u, spill.events);
+   EXPECT_EQ(0, spill.error);
+
+   std::vector<std::pair<uint32_t, std::string>> replayed;
+   EXPECT_EQ(1201, SpillQueues::Replay(kSpillPath, [&](uint32_t queueId, const char* event, size_t length) {
+      replayed.emplace_back(queueId, std::string(event, length));
+   }));
+   ASSERT_EQ(1201u, replayed.size());
+   EXPECT_EQ(std::make_pair(7u, std::string("order-0")), replayed.front());
+   EXPECT_EQ(std::make_pair(7u, std::string("order-1199")), replayed[1199]);
+   EXPECT_EQ(std::make_pair(9u, std::string("audit")), replayed.back());
+
+   std::ifstream input(kRecordPath, std::ios::binary);
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   EXPECT_NE(std::string::npos, json.str().find("\"queues\":2,\"events\":1201")) << json.str();
+   unlink(kRecordPath.c_str());
+   unlink(kSpillPath.c_str());
+   EXPECT_EQ(-1, SpillQueues::Replay(kSpillPath, [](uint32_t, const char*, size_t) {}));
+}
+
+TEST(SpillQueuesTest, FatalInCursorIsHandledAsRecursive) {
+   RaiiDeathCleanup cleanup;
+   SpillQueues::Clear();
+   ASSERT_TRUE(SpillQueues::Prepare(kSpillPath, 0));
+   int calls = 0;
+   ASSERT_GE(SpillQueues::Register(1, &FailingCursor, &calls), 0);
+   Death::SetupExitHandler();
+   CHECK(false) << "spill with a failing cursor";
+   SpillQueues::Clear();
+
+   EXPECT_EQ(1, calls);
+   EXPECT_TRUE(Death::WasKilled());
+   size_t spillStages = 0;
+   for (const auto& timing : Death::Timings()) {
+      spillStages += (timing.stage == CrashRecord::StageSpill);
+   }
+   EXPECT_EQ(2u, spillStages);
+   unlink(kSpillPath.c_str());
+}
+
+TEST(SpillQueuesTest, CursorPastTheBatchFailsTheSpill) {
+   SpillQueues::Clear();
+   ASSERT_TRUE(SpillQueues::Prepare(kSpillPath, 0));
+   std::string event = "event";
+   ASSERT_GE(SpillQueues::Register(4, &OvercountingCursor, &event), 0);
+
+   const auto spill = SpillQueues::SpillAll();
+   SpillQueues::Clear();
+   EXPECT_EQ(EINVAL, spill.error);
+   EXPECT_EQ(0u, spill.events);
+   EXPECT_EQ(EINVAL, SpillQueues::LastSpill().error);
+   EXPECT_EQ(0, SpillQueues::Replay(kSpillPath, [](uint32_t, const char*, size_t) {}));
+   unlink(kSpillPath.c_str());
+}
+
+TEST(SpillQueuesTest, ReplayStopsAtBatchesLargerThanTheFile) {
+   const int fd = open(kSpillPath.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+   ASSERT_GE(fd, 0);
+   const uint32_t length = 2;
+   SpillQueues::BatchHeader good{SpillQueues::kBatchMagic, 3, 1, 0, length};
+   SpillQueues::BatchHeader corrupt{SpillQueues::kBatchMagic, 3, 0x40000000, 0, 1ull << 60};
+   ASSERT_EQ(static_cast<ssize_t>(sizeof(good)), write(fd, &good, sizeof(good)));
+   ASSERT_EQ(static_cast<ssize_t>(sizeof(length)), write(fd, &length, sizeof(length)));
+   ASSERT_EQ(2, write(fd, "ok", 2));
+   ASSERT_EQ(static_cast<ssize_t>(sizeof(corrupt)), write(fd, &corrupt, sizeof(corrupt)));
+   close(fd);
+
+   std::vector<std::string> replayed;
+   EXPECT_EQ(1, SpillQueues::Replay(kSpillPath, [&](uint32_t, const char* event, size_t size) {
+      replayed.emplace_back(event, size);
+   }));
+   ASSERT_EQ(1u, replayed.size());
+   EXPECT_EQ("ok", replayed[0]);
+   unlink(kSpillPath.c_str());
+}
+
+TEST(SpillQueuesTest, ForkedChildDoesNotSpillIntoTheParentFile) {
+   SpillQueues::Clear();
+   ASSERT_TRUE(SpillQueues::Prepare(kSpillPath, 0));
+   TestQueue queue;
+   queue.events.push_back("parent");
+   ASSERT_GE(SpillQueues::Register(1, &NextEvents, &queue), 0);
+   EXPECT_TRUE(SpillQueues::HasQueues());
+
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      const bool skipped = !SpillQueues::HasQueues() && SpillQueues::SpillAll().error == EBADF;
+      _exit(skipped ? 0 : 1);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   EXPECT_TRUE(WIFEXITED(status));
+   EXPECT_EQ(0, WEXITSTATUS(status));
+   std::ifstream file(kSpillPath, std::ios::binary);
+   EXPECT_EQ(std::ifstream::traits_type::eof(), file.peek());
+   SpillQueues::Clear();
+   unlink(kSpillPath.c_str());
+}
@@ -0,0 +1,114 @@
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <Death.h>
+#include "CrashRecord.h"
+#include "ThreadContext.h"
+
+namespace {
+   const std::string kRecordPath = "/tmp/DeathKnell.threadcontext.test";
+
+   const ThreadContext::Record* Find(const std::vector<ThreadContext::Record>& records, pid_t tid) {
+      for (const auto& record : records) {
+         if (record.tid == tid) {
+            return &record;
+         }
+      }
+      return nullptr;
+   }
+}
+
+TEST(ThreadContextTest, SlotIsReleasedAtThreadExit) {
+   pid_t otherTid = 0;
+   std::vector<ThreadContext::Record> records;
+   std::thread other([&] {
+      otherTid = static_cast<pid_t>(syscall(SYS_gettid));
+      ThreadContext::SetTag(0, 7);
+      ThreadContext::SetLabel("worker");
+      ThreadContext::Snapshot(records);
+   });
+   other.join();
+   const auto* record = Find(records, otherTid);
+   ASSERT_NE(nullptr, record);
+   EXPECT_EQ(7u, record->tags[0]);
+   EXPECT_STREQ("worker", record->label);
+   EXPECT_STREQ("", record->name);
+
+   ThreadContext::Snapshot(records);
+   EXPECT_EQ(nullptr, Find(records, otherTid));
+}
+
+TEST(ThreadContextTest, ForkedChildKeepsOnlyTheForkingThread) {
+   ThreadContext::SetTag(2, 55);
+   std::promise<void> claimed;
+   std::promise<void> release;
+   std::thread other([&] {
+      ThreadContext::SetTag(0, 1);
+      claimed.set_value();
+      release.get_future().wait();
+   });
+   claimed.get_future().wait();
+
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      std::vector<ThreadContext::Record> records;
+      ThreadContext::Snapshot(records);
+      const pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+      const bool onlySelf = records.size() == 1 && records[0].tid == tid && records[0].tags[2] == 55;
+      _exit(onlySelf ? 0 : 1);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   release.set_value();
+   other.join();
+   EXPECT_TRUE(WIFEXITED(status));
+   EXPECT_EQ(0, WEXITSTATUS(status));
+   ThreadContext::Clear();
+}
+
+TEST(ThreadContextTest, CrashRecordHasEveryThreadContext) {
+   RaiiDeathCleanup cleanup;
+   unlink(kRecordPath.c_str());
+   Death::SetupExitHandler();
+   Death::SetCrashRecordPath(kRecordPath);
+   ThreadContext::SetTag(0, 1234);
+   ThreadContext::SetLabel("tenant-a");
+
+   std::promise<void> ready;
+   std::promise<void> release;
+   std::thread other([&] {
+      ThreadContext::SetName("io-worker-3", "io");
+      ThreadContext::SetTag(1, 99);
+      ThreadContext::SetLabel("connection");
+      volatile uint64_t spin = 0;
+      while (spin < 1000000) {
+         spin = spin + 1;
+      }
+      ready.set_value();
+      release.get_future().wait();
+   });
+   ready.get_future().wait();
+   CHECK(false) << "thread context test";
+   release.set_value();
+   other.join();
+   Death::SetCrashRecordPath("");
+   ThreadContext::Clear();
+
+   std::ifstream input(kRecordPath, std::ios::binary);
+   std::ostringstream json;
+   std::string error;
+   ASSERT_TRUE(CrashRecord::ToJson(input, json, error)) << error;
+   const std::string decoded = json.str();
+   EXPECT_NE(std::string::npos, decoded.find("\"faulting\":true,\"tags\":[1234,0,0,0],\"label\":\"tenant-a\"")) << decoded;
+   EXPECT_NE(std::string::npos, decoded.find("\"faulting\":false,\"tags\":[0,99,0,0],\"label\":\"connection\"")) << decoded;
+   EXPECT_NE(std::string::npos, decoded.find("\"name\":\"io-worker-3\",\"role\":\"io\",\"cpu_ns\":")) << decoded;
+   EXPECT_EQ(std::string::npos, decoded.find("\"role\":\"io\",\"cpu_ns\":0}")) << decoded;
+   unlink(kRecordPath.c_str());
+}
@@ -0,0 +1,69 @@
+
+#include <gtest/gtest.h>
+#include <future>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <Death.h>
+#include "Watchdog.h"
+
+TEST(WatchdogTest, StalledThreadRaisesAFatal) {
+   RaiiDeathCleanup cleanup;
+   Death::SetupExitHandler();
+   const uint64_t triggeredBefore = Watchdog::Triggered();
+
+   std::promise<void> watched;
+   std::promise<void> release;
+   std::thread stuck([&] {
+      ThreadContext::SetName("stuck-worker", "pool");
+      Watchdog::Watch(std::chrono::milliseconds(20));
+      watched.set_value();
+      release.get_future().wait();
+      Watchdog::Unwatch();
+   });
+   watched.get_future().wait();
+
+   std::atomic<bool> beating{true};
+   std::thread healthy([&] {
+      Watchdog::Watch(std::chrono::milliseconds(20));
+      while (beating) {
+         Watchdog::Beat();
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      Watchdog::Unwatch();
+   });
+
+   ASSERT_TRUE(Watchdog::Start(std::chrono::milliseconds(5)));
+   EXPECT_FALSE(Watchdog::Start(std::chrono::milliseconds(5)));
+   for (int attempt = 0; attempt < 2000 && !Death::WasKilled(); ++attempt) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   Watchdog::Stop();
+   release.set_value();
+   beating = false;
+   stuck.join();
+   healthy.join();
+
+   EXPECT_TRUE(Death::WasKilled());
+   EXPECT_EQ(triggeredBefore + 1, Watchdog::Triggered());
+   EXPECT_NE(std::string::npos, Death::Message().find("HANG: thread")) << Death::Message();
+   EXPECT_NE(std::string::npos, Death::Message().find("'stuck-worker' role 'pool'")) << Death::Message();
+}
+
+TEST(WatchdogTest, MonitorRestartsInForkedChild) {
+   Death::Instance();  // registers the fork handlers
+   ASSERT_TRUE(Watchdog::Start(std::chrono::milliseconds(5)));
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      alarm(10);
+      const bool started = Watchdog::Start(std::chrono::milliseconds(5));
+      Watchdog::Stop();
+      _exit(started ? 0 : 1);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   Watchdog::Stop();
+   ASSERT_TRUE(WIFEXITED(status)) << status;
+   EXPECT_EQ(0, WEXITSTATUS(status));
+}
@@ -0,0 +1,65 @@
+/**
+ * deathknell-inspect: decode a DeathKnell binary crash record to JSON
+ *
+ * usage: deathknell-inspect <record>             (use '-' to read from stdin)
+ *        deathknell-inspect --metrics <segment>  (published DeathMetrics block)
+ */
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "CrashRecord.h"
+#include "DeathMetrics.h"
+
+namespace {
+   int PrintMetrics(const std::string& segment) {
+      const DeathMetricsBlock* block = DeathMetrics::Attach(segment);
+      if (block == nullptr) {
+         std::cerr << "no DeathKnell metrics published as " << segment << std::endl;
+         return 1;
+      }
+      std::cout << "{\"pid\":" << block->pid
+              << ",\"registered_hooks\":" << block->registeredHooks.load()
+              << ",\"registrations\":" << block->registrations.load()
+              << ",\"clear_exits\":" << block->clearExits.load()
+              << ",\"deaths\":" << block->deaths.load()
+              << ",\"last_death_ns\":" << block->lastDeathNs.load()
+              << ",\"simulations\":" << block->simulations.load()
+              << ",\"last_simulation_ns\":" << block->lastSimulationNs.load()
+              << ",\"max_simulation_ns\":" << block->maxSimulationNs.load() << "}" << std::endl;
+      DeathMetrics::Detach(block);
+      return 0;
+   }
+}
+
+int main(int argc, char* argv[]) {
+   if (argc == 3 && std::string(argv[1]) == "--metrics") {
+      return PrintMetrics(argv[2]);
+   }
+   if (argc != 2) {
+      std::cerr << "usage: " << argv[0] << " <crash record | - for stdin>" << std::endl;
+      std::cerr << "       " << argv[0] << " --metrics <shared memory segment>" << std::endl;
+      return 2;
+   }
+   std::ios::sync_with_stdio(false);
+
+   std::vector<char> readBuffer(1 << 20);
+   std::ifstream file;
+   std::istream* input = &std::cin;
+   if (std::string(argv[1]) != "-") {
+      file.rdbuf()->pubsetbuf(readBuffer.data(), readBuffer.size());
+      file.open(argv[1], std::ios::binary);
+      if (!file) {
+         std::cerr << "cannot open " << argv[1] << std::endl;
+         return 1;
+      }
+      input = &file;
+   }
+
+   std::string error;
+   if (!CrashRecord::ToJson(*input, std::cout, error)) {
+      std::cout << std::flush;
+      std::cerr << argv[1] << ": " << error << std::endl;
+      return 1;
+   }
+   return 0;
+}